@@ -1,6 +1,7 @@
 #ifndef SHOT_H
 #define SHOT_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -29,6 +30,7 @@ public:
               out{0, 0, 0}, out_norm{0, 0, 0}, out_dist(0) {}
 
         std::string region;
+        int32_t region_id = -1;     // index into the file's region table (-1: named in region)
         point_t in;
         vect_t in_norm;
         double in_dist;
@@ -38,7 +40,7 @@ public:
         const double tol; // comparison tolerance
 
         inline bool operator==(const Partition& other) const {
-            return region == other.region &&
+            return region == other.region && region_id == other.region_id &&
                    VNEAR_EQUAL(in, other.in, tol) &&
                    VNEAR_EQUAL(in_norm, other.in_norm, tol) &&
                    NEAR_EQUAL(in_dist, other.in_dist, tol) &&
@@ -51,6 +53,9 @@ public:
     // Shot members
     Ray ray;
     std::vector<Partition> parts;
+    int64_t idx = -1;   // position in the diff run's ray pool (-1: not recorded)
+    int view = -1;      // view the ray was generated for (-1: not recorded)
+    bool derived_pts = false;   // in/out points rebuilt from ray and distance (compact results)
 
     inline bool operator==(const Shot& other) const {
         return ray == other.ray && parts == other.parts;
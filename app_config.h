@@ -0,0 +1,63 @@
+#ifndef APP_CONFIG_H
+#define APP_CONFIG_H
+
+#include <stdlib.h>
+#include <string>
+
+#include <brlcad/bu.h>
+#include <brlcad/raytrace.h>
+
+/* how much per-partition work the perf hit() callbacks do */
+enum HitLevel {
+    HIT_TRAVERSAL = 0,						    // partition lists only, no normals
+    HIT_NORMALS,						    // in/out normals
+    HIT_CURVATURE,						    // normals + curvature
+    HIT_UV,							    // normals + curvature + uv
+    HIT_LEVEL_CNT
+};
+
+/* librt application settings applied by the engine constructors */
+struct AppConfig {
+    int onehit = 0;						    // a_onehit: 0 returns all partitions, >0 stops after that many
+    int no_booleans = 0;					    // a_no_booleans: 1 returns raw segments without boolean weaving
+    int hit_level = HIT_NORMALS;				    // perf hit() work, see HitLevel (stored in a_user)
+    int bot_mintie = -1;					    // LIBRT_BOT_MINTIE during prep: -1 engine default, 0 no TIE, >0 min BoT faces for TIE
+    int bot_minpieces = -1;					    // rt_bot_minpieces during prep: -1 librt default, 0 never split BoTs into pieces
+    int bot_tri_per_piece = -1;					    // rt_bot_tri_per_piece during prep: -1 librt default
+    double max_dist = 0.0;					    // a_ray_length: >0 ignores hits farther along the ray
+};
+
+/* Override LIBRT_BOT_MINTIE (read by rt_bot_prep) for one prep and put
+ * the caller's setting back afterwards.  rt_bot_prep only copies the
+ * variable into librt's rt_bot_mintie while it is set, so unsetting it
+ * would leave the override in place for every later prep in the process -
+ * without a caller setting the variable is set to the threshold librt had
+ * before instead.  A negative threshold leaves the environment alone */
+class ScopedBotMintie {
+public:
+    explicit ScopedBotMintie(int mintie) : active(mintie >= 0) {
+	if (!active)
+	    return;
+	const char *prev = getenv("LIBRT_BOT_MINTIE");
+	prev_val = (prev) ? std::string(prev) : std::to_string(rt_bot_mintie);
+	bu_setenv("LIBRT_BOT_MINTIE", std::to_string(mintie).c_str(), 1);
+    }
+    ~ScopedBotMintie() { restore(); }
+
+    ScopedBotMintie(const ScopedBotMintie&) = delete;
+    ScopedBotMintie& operator=(const ScopedBotMintie&) = delete;
+
+    /* prep is complete: back to the caller's setting */
+    void restore() {
+	if (!active)
+	    return;
+	active = false;
+	bu_setenv("LIBRT_BOT_MINTIE", prev_val.c_str(), 1);
+    }
+
+private:
+    bool active;
+    std::string prev_val;
+};
+
+#endif /* APP_CONFIG_H */
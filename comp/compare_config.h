@@ -2,17 +2,38 @@
 #define COMPARE_CONFIG_H
 
 #include <string>
+#include <vector>
 #include <brlcad/vmath.h>
 
 /* useful information when comparing shotsets */
 struct CompareConfig {
     double tol = SMALL_FASTF;					    // comparison tolerance
 
+    bool ordered = false;					    // diff run: write shots in ray order; compare run: try a linear pass first
+    bool binary = false;					    // diff run: write the binary columnar shot format (comp/shotbin.h)
+    bool compact = false;					    // diff run: leave out hit points (rebuilt from ray + distance on read)
+    bool compress = false;					    // diff run: XOR-delta encode binary segments (implies binary)
+    bool compare_derived = false;				    // compare run: also compare hit points rebuilt from compact results
+    bool region_ids = false;					    // diff run: NDJSON partitions carry region ids into a trailing region table
+    bool digest = false;					    // diff run: write per-ray digests quantized to tol instead of shots
+    size_t max_memory = 0;					    // diff run: ceiling on buffered output bytes (0 picks a default)
+    int shard = 0;						    // diff run: which slice of the ray indices to shoot (0 based) ...
+    int nshards = 1;						    // ... out of this many; >1 writes a shard file and a manifest
+    bool resume = false;					    // diff run: carry on from the output's checkpoint log (ordered runs)
+    double checkpoint_seconds = 60;				    // diff run: seconds between checkpoints of ordered runs (0: none)
+    int refine_levels = 0;					    // pair diff run: levels of ever denser grids shot around differing rays
+    double budget_seconds = 0;					    // diff run: stop after this long, shooting rays in progressive order (0: no limit)
+    bool stream = false;					    // diff run: json_ofile is a pipe ("-": stdout) read as it is written - ordered, no result tree
+    std::vector<std::string> changed_regions;			    // update run: regions (names or leading paths) whose rays are re-shot
+
     // input file names
     std::string in_ray_file = std::string("");			    // if supplied: use .rays file for results generation
+    std::string update_file = std::string("");			    // if supplied: update run - re-shoot only the changed rays of this earlier result
+    std::string changed_since = std::string("");		    // update run: older .g whose regions are compared to find the changed ones
 
     // output file names
     std::string json_ofile = std::string("shots.json");		    // JSON shots result file
+    std::string digest_detail_file = std::string("");		    // digest diff run: full shots for mismatch checks (empty: not written)
     std::string ray_file = std::string("shots.rays");		    // rays shot in diff_run (not generated if in_ray_file supplied)
     std::string plot3_file = std::string("diff.plot3");		    // graphically view differences
     std::string nirt_file = std::string("diff.nrt");		    // xyz and dir of problem rays in compare_run (useful for feeding into individual nirt shots)
@@ -1,18 +1,954 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
 #include <set>
+#include <thread>
 #include <time.h>
+#include <unordered_map>
 
 #include "rtcmp.h"
 #include "shotset.h"
 #include "shot_comp.h"
+#include "shotdigest.h"
 #include "jsonwriter.hpp"
 
+/* rays per chunk handed out in ordered diff runs */
+#define ORDERED_CHUNK_RAYS 1024
+/* rays per chunk otherwise - small, so expensive views spread over all threads */
+#define DIFF_CHUNK_RAYS 256
+/* shots an update run reads from the earlier run before re-shooting their changed rays together */
+#define UPDATE_BATCH_SHOTS 65536
+/* keeps per-thread state written in the shooting loop off shared cache lines */
+#define CACHE_LINE_BYTES 64
+
+/*
+ * Everything one diff run thread writes while shooting.  Each is allocated
+ * by its own thread the first time it runs (so the memory is local to it)
+ * and aligned to a cache line, so no two threads ever write the same line.
+ */
+struct alignas(CACHE_LINE_BYTES) DiffThreadContext {
+    struct application app;	// a_ray is rewritten for every shot
+    tsj::Writer* writer = NULL;	// the thread's (thread_local) output writer
+    int64_t busy_usec = 0;
+    int64_t rays = 0;
+    int64_t chunks = 0;
+};
+
+/*
+ * The same for an in-process differential run: the thread's instance of
+ * each engine and the shots the two disagreed on
+ */
+struct alignas(CACHE_LINE_BYTES) PairThreadContext {
+    struct application app_a;
+    struct application app_b;
+    Shot shot_a{Shot::Ray(0.0)};	// the current ray, as each engine saw it
+    Shot shot_b{Shot::Ray(0.0)};
+    std::vector<Shot> diffs_a;		// shots that differ, in pairs
+    std::vector<Shot> diffs_b;
+    int64_t busy_usec = 0;
+    int64_t rays = 0;
+};
+
+/*
+ * And for an update run: the thread's application and the ray it is
+ * re-shooting, held until it replaces the earlier run's shot
+ */
+struct alignas(CACHE_LINE_BYTES) UpdateThreadContext {
+    struct application app;
+    Shot shot{Shot::Ray(0.0)};
+    int64_t busy_usec = 0;
+    int64_t rays = 0;
+    int64_t changed = 0;	// re-shot rays whose partitions came out different
+};
+
+/*
+ * Report shots found to differ by one of the streaming compares below, in
+ * the same form as ComparisonResult::summary()
+ */
+static void
+report_differing(const std::vector<Shot::Ray>& differing, const std::map<int, size_t>& view_diffs,
+		 size_t total, const CompareConfig& config)
+{
+    std::cout << "Used diff tolerance: " << config.tol << "\n";
+    if (differing.empty()) {
+	std::cout << "No differences found\n";
+	return;
+    }
+
+    std::cout << "Difference(s) found.\n";
+    std::cout << "\t(" << differing.size() << ") shots with unequal hit data.\n";
+    if (!view_diffs.empty()) {
+	std::cout << "\tdifferences by view:\n";
+	for (auto const& [view, count] : view_diffs)
+	    std::cout << "\t\tview " << view << ": " << count << "\n";
+    }
+    double percent_diff = (double)differing.size() / (double)total * 100.0;
+    std::cout << "\ttotal differences: " << differing.size() << " / " << total << " = ~" << std::fixed << std::setprecision(2) << percent_diff << "%\n";
+    std::cout << "See " << config.nirt_file << " for full differences.\n";
+
+    std::ofstream out(config.nirt_file, std::ios::out);
+    out << "** differing shots [" << differing.size() << "] **\n";
+    out << std::fixed << std::setprecision(17);
+    for (const Shot::Ray& ray : differing) {
+	out << "xyz " << ray.pt[X] << " " << ray.pt[Y] << " " << ray.pt[Z] << "\n" <<
+	       "dir " << ray.dir[X] << " " << ray.dir[Y] << " " << ray.dir[Z] << "\n";
+    }
+}
+
+/*
+ * Compare two ray-ordered shot files in lockstep, without indexing either.
+ * Returns false (having reported nothing) as soon as the files stop lining
+ * up, so the caller can fall back to the indexed comparison.
+ */
+static bool
+compare_ordered(const char *file1, const char *file2, const CompareConfig& config)
+{
+    // binary files are mapped, not parsed - the indexed compare is cheap
+    if (shotbin::isBinaryFile(file1) || shotbin::isBinaryFile(file2))
+	return false;
+
+    std::ifstream a(file1, std::ios::binary);
+    std::ifstream b(file2, std::ios::binary);
+    if (!a.is_open() || !b.is_open())
+	return false;
+
+    // region ids are only comparable through the files' tables
+    std::vector<std::string> table_a, table_b;
+    shot_utils::read_region_table(file1, table_a);
+    shot_utils::read_region_table(file2, table_b);
+    RegionMapper regions(table_a, table_b);
+
+    // next shot line (the region table is not a shot)
+    auto next_shot = [](std::ifstream& in, std::string& line) {
+	while (std::getline(in, line)) {
+	    if (!shot_utils::is_region_table(line))
+		return true;
+	}
+	return false;
+    };
+
+    std::vector<Shot::Ray> differing;
+    std::map<int, size_t> view_diffs;
+    size_t total = 0;
+    std::string la, lb;
+    while (true) {
+	bool ga = next_shot(a, la);
+	bool gb = next_shot(b, lb);
+	if (!ga || !gb) {
+	    if (ga != gb)
+		return false;	// one file is longer
+	    break;
+	}
+	if (la.empty() && lb.empty())
+	    continue;
+	total++;
+
+	// identical text is an identical shot - skip the parse
+	if (la == lb && regions.identical())
+	    continue;
+
+	Shot sa = shot_utils::parse_json_shot(la);
+	Shot sb = shot_utils::parse_json_shot(lb);
+	if (sa.idx >= 0 && sb.idx >= 0) {
+	    if (sa.idx != sb.idx)
+		return false;	// not the same ray order
+	} else if (shot_utils::hash_ray(sa.ray) != shot_utils::hash_ray(sb.ray)) {
+	    return false;
+	}
+	regions.align(sa, sb);
+	if (!shot_utils::shot_equal_at_tol(&sa, &sb, config.tol, config.compare_derived)) {
+	    differing.push_back(sa.ray);
+	    if (sa.view >= 0)
+		view_diffs[sa.view]++;
+	}
+    }
+
+    report_differing(differing, view_diffs, total, config);
+    return true;
+}
+
+/*
+ * Shots read front to back from a pipe (or any shot file), one batch at a
+ * time - NDJSON or binary, whichever the stream starts with.  "-" is
+ * standard input
+ */
+class ShotStream {
+public:
+    bool open(const std::string& path) {
+	p_path = path;
+	if (path != "-") {
+	    p_file.open(path, std::ios::binary);
+	    if (!p_file.is_open()) {
+		std::cerr << "failed to open " << path << std::endl;
+		return false;
+	    }
+	    p_in = &p_file;
+	}
+
+	// binary streams start with a file header, NDJSON with a shot
+	if (p_in->peek() != shotbin::FILE_MAGIC[0])
+	    return true;
+	shotbin::FileHeader h;
+	if (!p_in->read((char*)&h, sizeof(h)) || !shotbin::isBinary(&h, sizeof(h)) || h.version != shotbin::VERSION) {
+	    std::cerr << "not a shot stream: " << path << std::endl;
+	    return false;
+	}
+	p_binary = true;
+	p_flags = h.flags;
+	return true;
+    }
+
+    /* the next shots (a segment's worth, or up to max lines); false at the
+     * end of the stream or if it is malformed (see failed()) */
+    bool next(std::vector<Shot>& shots, size_t max = 4096) {
+	shots.clear();
+	if (p_binary)
+	    return p_nextSegment(shots);
+
+	std::string line;
+	while (shots.size() < max && std::getline(*p_in, line)) {
+	    if (line.empty() || shot_utils::is_region_table(line))
+		continue;
+	    if (p_in->eof()) {
+		// every shot ends its line; this one was cut off
+		std::cerr << "shot stream " << p_path << " ends in a partial shot" << std::endl;
+		p_failed = true;
+		return false;
+	    }
+	    try {
+		shots.push_back(shot_utils::parse_json_shot(line));
+	    } catch (const std::exception& e) {
+		std::cerr << "malformed shot in " << p_path << ": " << e.what() << std::endl;
+		p_failed = true;
+		return false;
+	    }
+	}
+	return !shots.empty();
+    }
+
+    bool failed() const { return p_failed; }
+
+private:
+    bool p_nextSegment(std::vector<Shot>& shots) {
+	shotbin::SegHeader h;
+	if (!p_in->read((char*)&h, sizeof(h))) {
+	    p_failed = (p_in->gcount() != 0);	// a partial header is a cut off stream
+	    return false;
+	}
+	p_seg.resize(std::max<uint64_t>(h.bytes, sizeof(h)));
+	std::memcpy(&p_seg[0], &h, sizeof(h));
+	if (!p_in->read(&p_seg[sizeof(h)], p_seg.size() - sizeof(h))) {
+	    std::cerr << "shot stream " << p_path << " ends in a partial segment" << std::endl;
+	    p_failed = true;
+	    return false;
+	}
+
+	const std::string* seg = &p_seg;
+	if (p_flags & shotbin::FLAG_COMPRESSED) {
+	    if (!shotbin::decompressSegment(p_seg.data(), p_seg.size(), p_flags, p_decoded)) {
+		std::cerr << "malformed compressed segment in " << p_path << std::endl;
+		p_failed = true;
+		return false;
+	    }
+	    seg = &p_decoded;
+	}
+	shotbin::SegmentView view;
+	if (!view.init(seg->data(), seg->size(), p_flags)) {
+	    std::cerr << "malformed segment in " << p_path << std::endl;
+	    p_failed = true;
+	    return false;
+	}
+	for (size_t i = 0; i < view.size(); i++)
+	    shots.push_back(view.shot(i));
+	return true;
+    }
+
+    std::string p_path;
+    std::ifstream p_file;
+    std::istream* p_in = &std::cin;
+    bool p_binary = false;
+    uint32_t p_flags = 0;
+    bool p_failed = false;
+    std::string p_seg, p_decoded;
+};
+
+/* batches of shots handed from a stream's reader thread to the compare;
+ * a few are buffered so neither side waits on every batch */
+struct ShotQueue {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::vector<Shot>> batches;
+    bool done = false;
+
+    void push(std::vector<Shot>&& batch) {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [this] { return batches.size() < 8; });
+	batches.push_back(std::move(batch));
+	cv.notify_all();
+    }
+
+    /* false once the reader is finished and everything has been taken */
+    bool pop(std::vector<Shot>& batch) {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [this] { return !batches.empty() || done; });
+	if (batches.empty())
+	    return false;
+	batch = std::move(batches.front());
+	batches.pop_front();
+	cv.notify_all();
+	return true;
+    }
+
+    void finish() {
+	std::lock_guard<std::mutex> lock(mtx);
+	done = true;
+	cv.notify_all();
+    }
+};
+
+/*
+ * Compare two ray ordered shot streams - typically two builds' diff runs
+ * writing into pipes at the same time - as the shots arrive.  Each stream
+ * is read and parsed by a thread of its own, so neither run waits on the
+ * other, and shots are matched by ray index; nothing touches the disk.
+ */
+static void
+compare_streams(const char *file1, const char *file2, const CompareConfig& config)
+{
+    ShotQueue qa, qb;
+    bool ok_a = false, ok_b = false;
+    auto reader = [](const char* path, ShotQueue* q, bool* ok) {
+	ShotStream s;
+	std::vector<Shot> batch;
+	if (s.open(path)) {
+	    while (s.next(batch))
+		q->push(std::move(batch));
+	    *ok = !s.failed();
+	}
+	q->finish();
+    };
+    std::thread ta(reader, file1, &qa, &ok_a);
+    std::thread tb(reader, file2, &qb, &ok_b);
+
+    struct Cursor {
+	ShotQueue& q;
+	std::vector<Shot> batch;
+	size_t i = 0;
+	const Shot* peek() {
+	    while (i == batch.size()) {
+		i = 0;
+		batch.clear();
+		if (!q.pop(batch))
+		    return NULL;
+	    }
+	    return &batch[i];
+	}
+    } ca{qa}, cb{qb};
+
+    // a ray missing from one stream shows up as a gap in its indices
+    std::vector<Shot::Ray> differing;
+    std::map<int, size_t> view_diffs;
+    size_t total = 0, only_a = 0, only_b = 0;
+    while (true) {
+	const Shot* a = ca.peek();
+	const Shot* b = cb.peek();
+	if (!a && !b)
+	    break;
+	total++;
+
+	// streams without ray indices can only be lined up by position
+	int64_t ka = (a) ? a->idx : std::numeric_limits<int64_t>::max();
+	int64_t kb = (b) ? b->idx : std::numeric_limits<int64_t>::max();
+	if (a && b && (ka < 0 || kb < 0))
+	    ka = kb = 0;
+	const Shot* diff = NULL;
+	if (ka < kb) {
+	    only_a++;
+	    diff = a;
+	    ca.i++;
+	} else if (kb < ka) {
+	    only_b++;
+	    diff = b;
+	    cb.i++;
+	} else {
+	    if (!shot_utils::shot_equal_at_tol(a, b, config.tol, config.compare_derived))
+		diff = a;
+	    ca.i++;
+	    cb.i++;
+	}
+	if (diff) {
+	    differing.push_back(diff->ray);
+	    if (diff->view >= 0)
+		view_diffs[diff->view]++;
+	}
+    }
+    ta.join();
+    tb.join();
+
+    // a stream cut short says nothing about the rays it did not deliver
+    if (!ok_a || !ok_b) {
+	std::cerr << "could not read all of " << ((!ok_a) ? file1 : file2) << ", no comparison made" << std::endl;
+	return;
+    }
+    if (only_a)
+	std::cerr << only_a << " shots only in " << file1 << std::endl;
+    if (only_b)
+	std::cerr << only_b << " shots only in " << file2 << std::endl;
+    report_differing(differing, view_diffs, total, config);
+}
+
+/* the shots of one result tree chunk, read straight from its byte range */
+static bool
+read_chunk(const char *file, const shotdigest::ChunkNode& c, std::vector<Shot>& shots)
+{
+    shots.clear();
+    std::ifstream in(file, std::ios::binary);
+    std::string buf(c.bytes, '\0');
+    if (!in.is_open() || !in.seekg(c.offset) || !in.read(&buf[0], buf.size()))
+	return false;
+
+    if (!shotbin::isBinaryFile(file)) {
+	size_t pos = 0;
+	while (pos < buf.size()) {
+	    size_t eol = buf.find('\n', pos);
+	    if (eol == std::string::npos)
+		eol = buf.size();
+	    if (eol > pos)
+		shots.push_back(shot_utils::parse_json_shot(buf.substr(pos, eol - pos)));
+	    pos = eol + 1;
+	}
+	return true;
+    }
+
+    // segments need the file header in front of them
+    char hdr[sizeof(shotbin::FileHeader)];
+    in.seekg(0);
+    if (!in.read(hdr, sizeof(hdr)))
+	return false;
+    buf.insert(0, hdr, sizeof(hdr));
+    std::vector<shotbin::SegmentView> segs;
+    std::vector<uint64_t> offsets;
+    std::vector<std::string> decoded;
+    if (!shotbin::loadSegments(buf.data(), buf.size(), segs, offsets, decoded, 1))
+	return false;
+    for (const shotbin::SegmentView& seg : segs) {
+	for (size_t i = 0; i < seg.size(); i++)
+	    shots.push_back(seg.shot(i));
+    }
+    return true;
+}
+
+/*
+ * Compare two ray-ordered shot files through their result trees: equal
+ * roots settle the compare outright, otherwise only the chunks whose
+ * hashes differ are read and compared.  Returns false if the files have
+ * no usable trees
+ */
+static bool
+compare_trees(const char *file1, const char *file2, const CompareConfig& config)
+{
+    shotdigest::Tree ta, tb;
+    if (!shotdigest::loadTree(file1, ta) || !shotdigest::loadTree(file2, tb))
+	return false;
+
+    // equal digests only promise equality within the step they used
+    if (ta.hdr.tol > config.tol) {
+	std::cerr << "result trees were hashed at tolerance " << ta.hdr.tol << ", coarser than " << config.tol << std::endl;
+	return false;
+    }
+    std::vector<size_t> chunks;
+    if (!shotdigest::differingChunks(ta, tb, chunks)) {
+	std::cerr << "result trees do not line up" << std::endl;
+	return false;
+    }
+
+    size_t total = 0;
+    for (const shotdigest::ChunkNode& c : ta.chunks)
+	total += c.nrays;
+
+    std::vector<std::string> table_a, table_b;
+    if (!chunks.empty()) {
+	shot_utils::read_region_table(file1, table_a);
+	shot_utils::read_region_table(file2, table_b);
+    }
+    RegionMapper regions(table_a, table_b);
+
+    std::vector<Shot::Ray> differing;
+    std::map<int, size_t> view_diffs;
+    std::vector<Shot> sa, sb;
+    for (size_t c : chunks) {
+	if (!read_chunk(file1, ta.chunks[c], sa) || !read_chunk(file2, tb.chunks[c], sb) || sa.size() != sb.size()) {
+	    std::cerr << "failed to read chunk " << c << " of the result trees" << std::endl;
+	    return false;
+	}
+	for (size_t i = 0; i < sa.size(); i++) {
+	    regions.align(sa[i], sb[i]);
+	    if (!shot_utils::shot_equal_at_tol(&sa[i], &sb[i], config.tol, config.compare_derived)) {
+		differing.push_back(sa[i].ray);
+		if (sa[i].view >= 0)
+		    view_diffs[sa[i].view]++;
+	    }
+	}
+    }
+
+    std::cout << "Compared result trees: " << chunks.size() << " of " << ta.chunks.size() << " chunks differ\n";
+    report_differing(differing, view_diffs, total, config);
+    return true;
+}
+
+/*
+ * Compare two digest files.  Matching digests are matching shots, so only
+ * the rays whose digests differ are looked up (and parsed) in the detail
+ * files - when both runs wrote one.  Without detail files every digest
+ * mismatch is reported, including values that only straddle a bin edge.
+ */
+static void
+compare_digests(const char *file1, const char *file2, const CompareConfig& config)
+{
+    shotdigest::File a, b;
+    if (!shotdigest::load(file1, a) || !shotdigest::load(file2, b))
+	return;
+    bool detail = !a.detail.empty() && !b.detail.empty();
+
+    // digests at different steps say nothing about each other, and equal
+    // digests only show agreement to within their own step
+    if (a.tol != b.tol || a.tol > config.tol) {
+	if (a.tol != b.tol)
+	    std::cerr << "digests were quantized at different tolerances (" << a.tol << " and " << b.tol << ")" << std::endl;
+	else
+	    std::cerr << "digests were quantized at tolerance " << a.tol << ", coarser than " << config.tol << std::endl;
+	if (!detail)
+	    return;
+	std::cerr << "comparing detail files " << a.detail << " and " << b.detail << " instead" << std::endl;
+	CompareConfig dconfig = config;
+	dconfig.ordered = false;
+	do_comp(a.detail.c_str(), b.detail.c_str(), dconfig);
+	return;
+    }
+
+    // ray ordered runs: with result trees, only keep rays of differing chunks
+    size_t total = a.recs.size();
+    shotdigest::Tree ta, tb;
+    std::vector<size_t> chunks;
+    if (shotdigest::loadTree(file1, ta) && shotdigest::loadTree(file2, tb) && shotdigest::differingChunks(ta, tb, chunks)) {
+	std::cout << "Compared result trees: " << chunks.size() << " of " << ta.chunks.size() << " chunks differ\n";
+	std::vector<std::pair<uint64_t, uint64_t>> ranges;	// <first_ray, end>
+	for (size_t c : chunks)
+	    ranges.emplace_back(ta.chunks[c].first_ray, ta.chunks[c].first_ray + ta.chunks[c].nrays);
+	std::sort(ranges.begin(), ranges.end());
+	auto outside = [&ranges](const shotdigest::Rec& r) {
+	    auto it = std::upper_bound(ranges.begin(), ranges.end(), std::make_pair(r.key, UINT64_MAX));
+	    return it == ranges.begin() || r.key >= std::prev(it)->second;
+	};
+	a.recs.erase(std::remove_if(a.recs.begin(), a.recs.end(), outside), a.recs.end());
+	b.recs.erase(std::remove_if(b.recs.begin(), b.recs.end(), outside), b.recs.end());
+    }
+
+    // ray ordered runs are sorted already
+    auto by_key = [](const shotdigest::Rec& l, const shotdigest::Rec& r) { return l.key < r.key; };
+    if (!std::is_sorted(a.recs.begin(), a.recs.end(), by_key))
+	std::sort(a.recs.begin(), a.recs.end(), by_key);
+    if (!std::is_sorted(b.recs.begin(), b.recs.end(), by_key))
+	std::sort(b.recs.begin(), b.recs.end(), by_key);
+
+    std::vector<uint64_t> mismatch, only_a, only_b;
+    size_t i = 0, j = 0;
+    while (i < a.recs.size() || j < b.recs.size()) {
+	if (j == b.recs.size() || (i < a.recs.size() && a.recs[i].key < b.recs[j].key)) {
+	    only_a.push_back(a.recs[i++].key);
+	} else if (i == a.recs.size() || b.recs[j].key < a.recs[i].key) {
+	    only_b.push_back(b.recs[j++].key);
+	} else {
+	    if (a.recs[i].digest != b.recs[j].digest)
+		mismatch.push_back(a.recs[i].key);
+	    i++;
+	    j++;
+	}
+    }
+
+    // settle digest mismatches against the full shots
+    std::vector<uint64_t> differing;
+    std::map<uint64_t, Shot::Ray> rays;
+    std::map<int, size_t> view_diffs;
+    size_t settled = 0;
+    if (!mismatch.empty() && detail) {
+	ShotIndex da(a.detail), db(b.detail);
+	if (!da.isValid() || !db.isValid() || !da.keyedByRayIndex() || !db.keyedByRayIndex()) {
+	    std::cerr << "detail files without ray indices, reporting every digest mismatch" << std::endl;
+	    differing = mismatch;
+	} else {
+	    RegionMapper regions(da.regionTable(), db.regionTable());
+	    for (uint64_t key : mismatch) {
+		std::optional<Shot> sa = da.getShot(key);
+		std::optional<Shot> sb = db.getShot(key);
+		if (sa && sb) {
+		    regions.align(*sa, *sb);
+		    if (shot_utils::shot_equal_at_tol(&*sa, &*sb, config.tol, config.compare_derived)) {
+			settled++;
+			continue;
+		    }
+		}
+		differing.push_back(key);
+		if (sa) {
+		    rays.emplace(key, sa->ray);
+		    if (sa->view >= 0)
+			view_diffs[sa->view]++;
+		}
+	    }
+	}
+    } else {
+	differing = mismatch;
+    }
+
+    std::cout << "Used diff tolerance: " << config.tol << " (digests quantized at " << a.tol << ")\n";
+    if (settled)
+	std::cout << "\t" << settled << " digest mismatches were equal at tolerance in the detail files\n";
+    size_t ndiff = differing.size() + only_a.size() + only_b.size();
+    if (!ndiff) {
+	std::cout << "No differences found\n";
+	return;
+    }
+
+    std::cout << "Difference(s) found.\n";
+    if (!differing.empty())
+	std::cout << "\t(" << differing.size() << ") shots with unequal hit data.\n";
+    if (!only_a.empty())
+	std::cout << "\t(" << only_a.size() << ") shots only in " << file1 << ".\n";
+    if (!only_b.empty())
+	std::cout << "\t(" << only_b.size() << ") shots only in " << file2 << ".\n";
+    if (!view_diffs.empty()) {
+	std::cout << "\tdifferences by view:\n";
+	for (auto const& [view, count] : view_diffs)
+	    std::cout << "\t\tview " << view << ": " << count << "\n";
+    }
+    double percent_diff = (double)ndiff / (double)total * 100.0;
+    std::cout << "\ttotal differences: " << ndiff << " / " << total << " = ~" << std::fixed << std::setprecision(2) << percent_diff << "%\n";
+    std::cout << "See " << config.nirt_file << " for full differences.\n";
+
+    // rays are only known from the detail files; list ray indices otherwise
+    std::ofstream out(config.nirt_file, std::ios::out);
+    out << "** differing shots [" << differing.size() << "] **\n";
+    out << std::fixed << std::setprecision(17);
+    for (uint64_t key : differing) {
+	auto it = rays.find(key);
+	if (it == rays.end()) {
+	    out << "# ray_idx " << key << "\n";
+	    continue;
+	}
+	const Shot::Ray& ray = it->second;
+	out << "xyz " << ray.pt[X] << " " << ray.pt[Y] << " " << ray.pt[Z] << "\n" <<
+	       "dir " << ray.dir[X] << " " << ray.dir[Y] << " " << ray.dir[Z] << "\n";
+    }
+    if (!only_a.empty()) {
+	out << "** shots only in " << file1 << " [" << only_a.size() << "] **\n";
+	for (uint64_t key : only_a)
+	    out << "# ray_idx " << key << "\n";
+    }
+    if (!only_b.empty()) {
+	out << "** shots only in " << file2 << " [" << only_b.size() << "] **\n";
+	for (uint64_t key : only_b)
+	    out << "# ray_idx " << key << "\n";
+    }
+}
+
+/*
+ * Sharded diff runs.  Shard k of N shoots the ray indices
+ * [k*total/N, (k+1)*total/N) into <output>.shard<k>of<N><ext>, and every
+ * shard writes the same manifest, <output>.manifest, listing all of them
+ * together with the rays shot and the build that shot them.  Shards can
+ * run as separate processes, or on separate machines, and are compared as
+ * one run by handing do_comp() the two manifests.
+ */
+#define SHARD_MANIFEST_HEADER "**rtcmp shard manifest**"
+
+static std::string
+shard_file(const std::string& base, int shard, int nshards)
+{
+    std::filesystem::path p(base);
+    std::string tag = ".shard" + std::to_string(shard) + "of" + std::to_string(nshards);
+    return (p.parent_path() / (p.stem().string() + tag + p.extension().string())).string();
+}
+
+struct ShardManifest {
+    struct Shard {
+	int64_t first = 0;	// ray indices [first, end)
+	int64_t end = 0;
+	std::string file;	// relative to the manifest
+    };
+    int64_t total_rays = 0;
+    std::string engine;
+    std::string build;		// librt version string
+    std::string geometry;
+    std::string rays;		// ray generator parameters or ray list, "key value" lines
+    std::vector<Shard> shards;
+
+    void init(int64_t total, int nshards, const std::string& output) {
+	total_rays = total;
+	shards.resize(nshards);
+	for (int k = 0; k < nshards; k++) {
+	    shards[k].first = total * k / nshards;
+	    shards[k].end = total * (k + 1) / nshards;
+	    shards[k].file = std::filesystem::path(shard_file(output, k, nshards)).filename().string();
+	}
+    }
+
+    /* every shard writes the manifest; each writes a whole file of its own
+     * and renames it over, so readers never see a partial one */
+    bool write(const std::string& path, int shard) const {
+	std::string tmp = path + ".tmp" + std::to_string(shard);
+	{
+	    std::ofstream out(tmp, std::ios::trunc);
+	    if (!out.is_open()) {
+		std::cerr << "failed to open shard manifest: " << tmp << std::endl;
+		return false;
+	    }
+	    out << SHARD_MANIFEST_HEADER << "\n";
+	    out << "shards " << shards.size() << "\n";
+	    out << "total_rays " << total_rays << "\n";
+	    out << "engine " << engine << "\n";
+	    out << "build " << build << "\n";
+	    out << "geometry " << geometry << "\n";
+	    std::istringstream lines(rays);
+	    std::string line;
+	    while (std::getline(lines, line))
+		out << "rays " << line << "\n";
+	    for (size_t k = 0; k < shards.size(); k++)
+		out << "shard " << k << " " << shards[k].first << " " << shards[k].end << " " << shards[k].file << "\n";
+	    if (!out.good()) {
+		std::cerr << "failed to write shard manifest: " << tmp << std::endl;
+		return false;
+	    }
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp, path, ec);
+	if (ec) {
+	    std::cerr << "failed to write shard manifest: " << path << " (" << ec.message() << ")" << std::endl;
+	    return false;
+	}
+	return true;
+    }
+
+    bool read(const std::string& path) {
+	std::ifstream in(path);
+	std::string line, key;
+	if (!std::getline(in, line) || line != SHARD_MANIFEST_HEADER) {
+	    std::cerr << "not a shard manifest: " << path << std::endl;
+	    return false;
+	}
+	size_t nshards = 0;
+	while (std::getline(in, line)) {
+	    std::istringstream iss(line);
+	    iss >> key;
+	    std::string rest;
+	    std::getline(iss >> std::ws, rest);
+	    if (key == "shards") {
+		nshards = std::stoul(rest);
+	    } else if (key == "total_rays") {
+		total_rays = std::stoll(rest);
+	    } else if (key == "engine") {
+		engine = rest;
+	    } else if (key == "build") {
+		build = rest;
+	    } else if (key == "geometry") {
+		geometry = rest;
+	    } else if (key == "rays") {
+		rays += rest + "\n";
+	    } else if (key == "shard") {
+		Shard s;
+		size_t k = 0;
+		std::istringstream sl(rest);
+		sl >> k >> s.first >> s.end >> std::ws;
+		std::getline(sl, s.file);
+		if (k != shards.size())
+		    break;
+		shards.push_back(s);
+	    }
+	}
+	if (!nshards || shards.size() != nshards) {
+	    std::cerr << "incomplete shard manifest: " << path << std::endl;
+	    return false;
+	}
+	return true;
+    }
+
+    /* shard k's file, found next to the manifest */
+    std::string file(const std::string& path, size_t k) const {
+	return (std::filesystem::path(path).parent_path() / shards[k].file).string();
+    }
+
+    static bool isManifest(const std::string& path) {
+	std::ifstream in(path);
+	std::string line;
+	return std::getline(in, line) && line == SHARD_MANIFEST_HEADER;
+    }
+};
+
+/*
+ * Compare two sharded runs shard by shard.  Shard files are indexed and
+ * compared in parallel, a few at a time, then reported in shard order with
+ * one nirt file per shard.  Returns false if neither file is a manifest.
+ */
+static bool
+compare_shards(const char *file1, const char *file2, const CompareConfig& config)
+{
+    bool manifest1 = ShardManifest::isManifest(file1);
+    if (!manifest1 && !ShardManifest::isManifest(file2))
+	return false;
+    if (manifest1 != ShardManifest::isManifest(file2)) {
+	std::cerr << "cannot compare a shard manifest with a shot file" << std::endl;
+	return true;
+    }
+
+    ShardManifest a, b;
+    if (!a.read(file1) || !b.read(file2))
+	return true;
+    if (a.shards.size() != b.shards.size()) {
+	std::cerr << "runs have different shard counts (" << a.shards.size() << " and " << b.shards.size() << ")" << std::endl;
+	return true;
+    }
+    size_t nshards = a.shards.size();
+    for (size_t k = 0; k < nshards; k++) {
+	if (a.shards[k].first != b.shards[k].first || a.shards[k].end != b.shards[k].end) {
+	    std::cerr << "shard " << k << " covers different rays in the two runs" << std::endl;
+	    return true;
+	}
+    }
+    if (a.rays != b.rays)
+	std::cerr << "warning: the two runs were not shot from the same rays" << std::endl;
+
+    std::cout << "Comparing " << nshards << " shards of " << a.total_rays << " rays\n";
+    std::cout << "\t" << file1 << ": " << a.engine << ", " << a.build << "\n";
+    std::cout << "\t" << file2 << ": " << b.engine << ", " << b.build << "\n";
+
+    // summaries leave cout in fixed notation; each shard starts afresh
+    std::ios_base::fmtflags cout_flags = std::cout.flags();
+    std::streamsize cout_precision = std::cout.precision();
+
+    std::vector<std::string> files_a(nshards), files_b(nshards);
+    bool fast_paths = false;
+    for (size_t k = 0; k < nshards; k++) {
+	files_a[k] = a.file(file1, k);
+	files_b[k] = b.file(file2, k);
+	if (!std::filesystem::exists(files_a[k]) || !std::filesystem::exists(files_b[k])) {
+	    std::cerr << "missing shard " << k << ": " << files_a[k] << " / " << files_b[k] << std::endl;
+	    return true;
+	}
+	if (shotdigest::isDigestFile(files_a[k]) || std::filesystem::exists(shotdigest::treePath(files_a[k])))
+	    fast_paths = true;
+    }
+
+    // digest and result tree shards already skip the full compare; take
+    // them one at a time through do_comp
+    if (fast_paths) {
+	for (size_t k = 0; k < nshards; k++) {
+	    std::cout.flags(cout_flags);
+	    std::cout.precision(cout_precision);
+	    std::cout << "Shard " << k << " (rays " << a.shards[k].first << " - " << a.shards[k].end << "):\n";
+	    CompareConfig shard_config = config;
+	    shard_config.nirt_file = shard_file(config.nirt_file, (int)k, (int)nshards);
+	    do_comp(files_a[k].c_str(), files_b[k].c_str(), shard_config);
+	}
+	return true;
+    }
+
+    // each shard is reported (in the order they finish) and let go as soon
+    // as it is compared, so only the shards in flight hold their indexes
+    size_t ncpus = std::max<size_t>(bu_avail_cpus(), 1);
+    size_t nworkers = std::min(ncpus, nshards);
+    int shard_threads = (int)std::max<size_t>(ncpus / nworkers, 1);
+    std::atomic<size_t> next_shard{0};
+    std::mutex report_mtx;
+    size_t total_diffs = 0, differing_shards = 0, failed_shards = 0;
+    auto work = [&]() {
+	size_t k;
+	while ((k = next_shard.fetch_add(1)) < nshards) {
+	    // the result holds on to both indexes, so it goes first
+	    std::unique_ptr<ShotIndex> ia(new ShotIndex(files_a[k]));
+	    std::unique_ptr<ShotIndex> ib(new ShotIndex(files_b[k]));
+	    std::unique_ptr<ComparisonResult> result;
+	    if (ia->isValid() && ib->isValid()) {
+		if (ia->keyedByRayIndex() != ib->keyedByRayIndex()) {
+		    ia->rekeyByHash();
+		    ib->rekeyByHash();
+		}
+		result.reset(new ComparisonResult(*ia, *ib, config.tol, shard_threads, config.compare_derived));
+	    }
+
+	    std::lock_guard<std::mutex> lock(report_mtx);
+	    std::cout.flags(cout_flags);
+	    std::cout.precision(cout_precision);
+	    std::cout << "Shard " << k << " (rays " << a.shards[k].first << " - " << a.shards[k].end << "):\n";
+	    if (!result) {
+		std::cerr << "Failed to index " << ((ia->isValid()) ? files_b[k] : files_a[k]) << std::endl;
+		failed_shards++;
+		continue;
+	    }
+	    result->summary(shard_file(config.nirt_file, (int)k, (int)nshards));
+	    total_diffs += result->differences();
+	    if (result->differences())
+		differing_shards++;
+	}
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < nworkers; i++)
+	workers.emplace_back(work);
+    for (std::thread& t : workers)
+	t.join();
+
+    std::cout << "Shards with differences: " << differing_shards << " / " << nshards;
+    if (failed_shards)
+	std::cout << " (" << failed_shards << " could not be compared)";
+    std::cout << ", total differences: " << total_diffs << "\n";
+    return true;
+}
+
 void do_comp(const char *file1, const char *file2, const CompareConfig& config) {
+    // pipes are read once, as they are written: no indexes, no second pass
+    if (shot_utils::is_pipe(file1) || shot_utils::is_pipe(file2)) {
+	compare_streams(file1, file2, config);
+	return;
+    }
+
+    // sharded runs: compare shard files pairwise
+    if (compare_shards(file1, file2, config))
+	return;
+
+    // ray ordered runs leave result trees; descend only where they differ
+    if (!shotdigest::isDigestFile(file1) && compare_trees(file1, file2, config))
+	return;
+
+    // digest runs: compare 16 byte records, look at shots only where they differ
+    bool digest1 = shotdigest::isDigestFile(file1);
+    if (digest1 || shotdigest::isDigestFile(file2)) {
+	if (digest1 != shotdigest::isDigestFile(file2)) {
+	    std::cerr << "cannot compare a digest file with a shot file" << std::endl;
+	    return;
+	}
+	compare_digests(file1, file2, config);
+	return;
+    }
+
+    // files written in ray order line up - one streaming pass, no indexes
+    if (config.ordered) {
+	if (compare_ordered(file1, file2, config))
+	    return;
+	if (!shotbin::isBinaryFile(file1) && !shotbin::isBinaryFile(file2))
+	    std::cerr << "shot files are not in matching ray order, falling back to indexed compare" << std::endl;
+    }
+
     // build indexes for both shot files
     ShotIndex s1(file1);
     if (!s1.isValid()) {
@@ -20,216 +956,1398 @@ void do_comp(const char *file1, const char *file2, const CompareConfig& config)
         return; // or handle error appropriately?
     }
 
-    ShotIndex s2(file2);
-    if (!s2.isValid()) {
-        std::cerr << "Failed to index " << file2 << std::endl;
-        return;
+    ShotIndex s2(file2);
+    if (!s2.isValid()) {
+        std::cerr << "Failed to index " << file2 << std::endl;
+        return;
+    }
+
+    // ray indices only match up if both files have them
+    if (s1.keyedByRayIndex() != s2.keyedByRayIndex()) {
+        std::cerr << "only one shot file records ray indices, matching by ray hash" << std::endl;
+        s1.rekeyByHash();
+        s2.rekeyByHash();
+    }
+
+    ComparisonResult results(s1, s2, config.tol, 0, config.compare_derived);
+    results.summary(config.nirt_file);
+}
+
+/*
+ * The generated diff run ray pool: per view one accuracy ray through the
+ * model centre followed by rings of rays around it (the layout
+ * rt_raybundle_maker() produces).  Ray i is computed from its index alone,
+ * so threads generate rays as they go and a second build reproduces the
+ * same pool from the few parameters written to the ray file.
+ */
+#define RAY_GENERATOR_HEADER "**ray generator**"
+
+struct RayGenerator {
+    int64_t view_rays = 0;	// rays per view, accuracy ray included
+    int rays_per_ring = 100;
+    double radius = 0;
+    point_t center = VINIT_ZERO;
+    vect_t dir[NUMVIEWS];
+    vect_t avec[NUMVIEWS];
+    vect_t bvec[NUMVIEWS];
+    bool progressive = false;	// rays are shot in position() order
+    int64_t prefix = -1;	// progressive runs cut short: positions shot (-1: all)
+
+    void init(int64_t rays_per_view, const point_t c, double r) {
+	view_rays = rays_per_view + 1;
+	radius = r;
+	VMOVE(center, c);
+	p_setupViews();
+    }
+
+    int64_t total() const { return NUMVIEWS * view_rays; }
+
+    /* Progressive order: position p shoots view p % NUMVIEWS, taking that
+     * view's rays in bit-reversed index order, so any prefix covers every
+     * view evenly - inner and outer rings, all the way round.  Reversed
+     * indices past the view's rays are holes (-1) */
+    int64_t positions() const { return NUMVIEWS * ((int64_t)1 << p_orderBits()); }
+
+    int64_t position(int64_t p) const {
+	int bits = p_orderBits();
+	uint64_t q = (uint64_t)(p / NUMVIEWS);
+	uint64_t k = 0;
+	for (int b = 0; b < bits; b++)
+	    k |= ((q >> b) & 1) << (bits - 1 - b);
+	return ((int64_t)k < view_rays) ? (p % NUMVIEWS) * view_rays + (int64_t)k : -1;
+    }
+
+    /* distance between neighbouring rings - how far apart the rays are */
+    double spacing() const { return radius / (double)std::max<int64_t>((view_rays - 1) / rays_per_ring, 1); }
+
+    void ray(int64_t i, struct xray* r) const {
+	int view = (int)(i / view_rays);
+	int64_t k = i % view_rays;
+	point_t origin;
+	VJOIN1(origin, center, -radius, dir[view]);
+	VMOVE(r->r_dir, dir[view]);
+	r->magic = RT_RAY_MAGIC;
+	r->index = (size_t)i;
+	if (k == 0) {
+	    VMOVE(r->r_pt, origin);
+	    return;
+	}
+
+	// rings spiral out to the radius; rays past the last full ring
+	// continue the spiral just beyond it
+	int64_t nring = std::max<int64_t>((view_rays - 1) / rays_per_ring, 1);
+	int64_t ring = (k - 1) / rays_per_ring;
+	int64_t in_ring = (k - 1) % rays_per_ring;
+	double delta = M_2PI / rays_per_ring;
+	double fraction = (double)(ring + 1) / (double)nring;
+
+	// stepped round the ring as rt_raybundle_maker() does, so the origins
+	// come out bit for bit the same as in ray lists it made
+	double theta = delta * fraction;
+	for (int64_t j = 0; j < in_ring; j++)
+	    theta += delta;
+	double radial_scale = radius * fraction;
+	VJOIN2(r->r_pt, origin, cos(theta) * radial_scale, avec[view], sin(theta) * radial_scale, bvec[view]);
+    }
+
+    /* the generator parameters, one "key value" per line */
+    std::string describe() const {
+	char buf[256];
+	std::string s;
+	snprintf(buf, sizeof(buf), "views %d\nview_rays %lld\nrays_per_ring %d\n", NUMVIEWS, (long long)view_rays, rays_per_ring);
+	s += buf;
+	snprintf(buf, sizeof(buf), "radius %.17g\ncenter %.17g %.17g %.17g\n", radius, V3ARGS(center));
+	s += buf;
+	if (progressive)
+	    s += "order progressive\n";
+	if (prefix >= 0)
+	    s += "prefix " + std::to_string(prefix) + "\n";
+	return s;
+    }
+
+    /* the generator descriptor that stands in for a list of rays - renamed
+     * into place, so a second build started alongside (waiting for it to
+     * appear) never reads a partial one */
+    bool write(const std::string& path) const {
+	std::string tmp = path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "w");	// intentionally erase contents if file already exists
+	if (!f) {
+	    std::cerr << "failed to open ray_file: " << tmp << std::endl;
+	    return false;
+	}
+	bool ok = fprintf(f, "%s\n%s", RAY_GENERATOR_HEADER, describe().c_str()) >= 0;
+	if (fclose(f) != 0 || !ok) {
+	    std::cerr << "failed to write ray_file: " << tmp << std::endl;
+	    return false;
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp, path, ec);
+	if (ec) {
+	    std::cerr << "failed to write ray_file: " << path << " (" << ec.message() << ")" << std::endl;
+	    return false;
+	}
+	return true;
+    }
+
+    bool read(const std::string& path) {
+	std::ifstream in(path);
+	std::string line, key;
+	if (!std::getline(in, line) || line != RAY_GENERATOR_HEADER)
+	    return false;
+	int views = 0;
+	while (std::getline(in, line)) {
+	    std::istringstream iss(line);
+	    iss >> key;
+	    if (key == "views")
+		iss >> views;
+	    else if (key == "view_rays")
+		iss >> view_rays;
+	    else if (key == "rays_per_ring")
+		iss >> rays_per_ring;
+	    else if (key == "radius")
+		iss >> radius;
+	    else if (key == "center")
+		iss >> center[X] >> center[Y] >> center[Z];
+	    else if (key == "order") {
+		std::string order;
+		iss >> order;
+		progressive = (order == "progressive");
+	    } else if (key == "prefix")
+		iss >> prefix;
+	}
+	if (views != NUMVIEWS || view_rays < 1 || rays_per_ring < 1) {
+	    std::cerr << "unusable ray generator in " << path << std::endl;
+	    return false;
+	}
+	p_setupViews();
+	return true;
+    }
+
+    static bool isDescriptor(const std::string& path) {
+	std::ifstream in(path);
+	std::string line;
+	return std::getline(in, line) && line == RAY_GENERATOR_HEADER;
+    }
+
+private:
+    /* bits of the largest index in a view */
+    int p_orderBits() const {
+	int bits = 0;
+	while (((int64_t)1 << bits) < view_rays)
+	    bits++;
+	return bits;
+    }
+
+    void p_setupViews() {
+	// TODO: better and/or random dirs?
+	static const vect_t dirs[NUMVIEWS] = {
+	    {0,0,1}, {0,1,0}, {1,0,0},			/* axis */
+	    {1,1,1}, {1,4,-1}, {-1,-2,4}		/* non-axis */
+	};
+	for (int j = 0; j < NUMVIEWS; j++) {
+	    VMOVE(dir[j], dirs[j]);
+	    VUNITIZE(dir[j]);
+
+	    /* set up an othographic grid */
+	    bn_vec_ortho(avec[j], dir[j]);
+	    VCROSS(bvec[j], dir[j], avec[j]);
+	    VUNITIZE(bvec[j]);
+	}
+    }
+};
+
+/*
+ *  Helper Function to load an array of rays to fire from a ray list file
+ */
+struct xray* read_ray_array(int64_t* total_rays, const std::string& in_ray_file) {
+    // open file
+    std::ifstream rayfile(in_ray_file, std::ios::binary);
+    if (!rayfile.is_open()) {
+	std::cerr << "failed to open ray_file: " << in_ray_file << std::endl;
+	return NULL;
+    }
+
+    // parse, load into array
+    struct xray* rays = NULL;
+    int64_t ray_idx = 0;
+    std::string line;
+    bool in_section = false;
+    while (std::getline(rayfile, line)) {
+	// trim leading/trailing whitespace
+	line.erase(0, line.find_first_not_of(" \t"));
+	line.erase(line.find_last_not_of(" \t") + 1);
+
+	if (in_section) {
+	    if (ray_idx >= *total_rays)
+		break;
+
+	    std::istringstream iss(line);
+	    std::string prefix;
+	    double x, y, z;
+	    // assumes line is point: xyz 123.4 234.5 345.6
+	    //	    or direction: dir 123.4 234.5 345.6
+	    iss >> prefix >> x >> y >> z;
+
+	    if (prefix == "xyz") {
+		rays[ray_idx].r_pt[0] = x;
+		rays[ray_idx].r_pt[1] = y;
+		rays[ray_idx].r_pt[2] = z;
+	    } else {
+		// assume this is 'dir' line
+		rays[ray_idx].r_dir[0] = x;
+		rays[ray_idx].r_dir[1] = y;
+		rays[ray_idx].r_dir[2] = z;
+
+		// got dir; next ray's up
+		ray_idx++;
+	    }
+	} else if (line.rfind("**", 0) == 0) {  // check for section start
+	    // extract amount of rays from section header
+	    size_t startIdx = line.find('[');
+	    size_t endIdx = line.find(']');
+	    if (startIdx == std::string::npos || endIdx == std::string::npos) {
+		std::cerr << "no ray count in " << in_ray_file << std::endl;
+		return NULL;
+	    }
+	    // assume number in bracket is number of rays we need to read
+	    *total_rays = std::stoll(line.substr(startIdx + 1, endIdx - startIdx - 1));
+	    rays = (struct xray *)bu_calloc(std::max<int64_t>(*total_rays, 1), sizeof(struct xray), "allocating ray space");
+	    in_section = true;
+	}
+    }
+
+    // fire only the rays the file actually holds
+    if (rays && ray_idx < *total_rays) {
+	std::cerr << in_ray_file << " lists " << ray_idx << " of " << *total_rays << " rays" << std::endl;
+	*total_rays = ray_idx;
+    }
+    return rays;
+}
+
+/*
+ * Set up the rays of a diff run: generated around inst's model as they are
+ * shot (gen), or read from dinfo.in_ray_file - either a generator
+ * descriptor or a list of rays, returned in *rays (MUST FREE)
+ */
+static bool
+diff_run_rays(void* inst, int64_t rays_per_view,
+	int (*getbox) (void *, point_t *, point_t *),
+	double (*getsize) (void *),
+	const CompareConfig& dinfo, RayGenerator& gen, struct xray** rays, int64_t* total_rays)
+{
+    *rays = NULL;
+    *total_rays = 0;
+    if (dinfo.in_ray_file.empty()) {
+	double radius = getsize(inst);
+	point_t bbox[3];
+	getbox(inst, bbox, bbox +1);
+	VADD2SCALE(bbox[2], bbox[0], bbox[1], 0.5);
+	gen.init(rays_per_view, bbox[2], radius);
+	gen.progressive = (dinfo.budget_seconds > 0);
+
+	// without the descriptor a second build has nothing to replay
+	if (!gen.write(dinfo.ray_file))
+	    return false;
+	*total_rays = gen.total();
+    } else if (RayGenerator::isDescriptor(dinfo.in_ray_file)) {
+	if (!gen.read(dinfo.in_ray_file))
+	    return false;
+	*total_rays = gen.total();
+    } else {
+	*rays = read_ray_array(total_rays, dinfo.in_ray_file);
+	if (!*rays)
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * TODO:
+ *	* Shoot on a grid set instead of a single ray.
+ */
+void
+do_diff_run(const char *prefix, int argc, const char **argv, int nthreads, int64_t rays_per_view,
+	void *(*constructor) (const char *, int, const char **, std::string, const AppConfig&),
+	int (*getbox) (void *, point_t *, point_t *),
+	double (*getsize) (void *),
+	void (*shoot) (void *, struct xray * ray),
+	int (*destructor) (void *),
+	CompareConfig& dinfo,
+	const AppConfig& acfg)
+{
+    nthreads = (nthreads == 0) ? bu_avail_cpus() : nthreads;	// 0 implies maximize cpu
+
+    /* base instance for this run */
+    void* base_inst = constructor(*argv, argc-1, argv+1, dinfo.json_ofile, acfg);
+    if (base_inst == NULL) {
+	return;
+    }
+
+    struct application* base_app = (struct application*)base_inst;
+
+    // rays are generated as they are shot, unless a list of rays was given
+    RayGenerator gen;
+    struct xray* rays = NULL;	// MUST FREE
+    int64_t total_rays = 0;
+    if (!diff_run_rays(base_inst, rays_per_view, getbox, getsize, dinfo, gen, &rays, &total_rays)) {
+	destructor(base_inst);
+	return;
     }
 
-    ComparisonResult results(s1, s2, config.tol);
-    results.summary(config.nirt_file);
+    // progressive runs go out in their own order, and one cut short by its
+    // time budget is replayed exactly as far as it got
+    if (rays && dinfo.budget_seconds > 0) {
+	std::cerr << "a time budget needs generated rays, not the ray list " << dinfo.in_ray_file << std::endl;
+	destructor(base_inst);
+	bu_free(rays, "ray buffer");
+	return;
+    }
+    int64_t positions = 0;
+    if (!rays && gen.progressive) {
+	dinfo.ordered = true;
+	positions = (gen.prefix >= 0) ? std::min(gen.prefix, gen.positions()) : gen.positions();
+	if (gen.prefix >= 0 && dinfo.budget_seconds > 0)
+	    std::cerr << "replaying the " << gen.prefix << " positions " << dinfo.in_ray_file << " records, ignoring the time budget" << std::endl;
+    }
+
+    // sharded runs shoot their slice of the rays into a file of their own
+    CompareConfig out_config = dinfo;
+    int64_t first_ray = 0, end_ray = total_rays;
+    if (dinfo.nshards > 1) {
+	ShardManifest manifest;
+	manifest.init(total_rays, dinfo.nshards, dinfo.json_ofile);
+	manifest.engine = prefix;
+	manifest.build = rt_version();
+	manifest.build = manifest.build.substr(0, manifest.build.find('\n'));
+	for (int i = 0; i < argc; i++)
+	    manifest.geometry += std::string((i) ? " " : "") + argv[i];
+	manifest.rays = (rays) ? "ray_file " + dinfo.in_ray_file + "\n" : gen.describe();
+
+	first_ray = manifest.shards[dinfo.shard].first;
+	end_ray = manifest.shards[dinfo.shard].end;
+	out_config.json_ofile = shard_file(dinfo.json_ofile, dinfo.shard, dinfo.nshards);
+	if (!dinfo.digest_detail_file.empty())
+	    out_config.digest_detail_file = shard_file(dinfo.digest_detail_file, dinfo.shard, dinfo.nshards);
+	if (!manifest.write(dinfo.json_ofile + ".manifest", dinfo.shard)) {
+	    destructor(base_inst);
+	    if (rays)
+		bu_free(rays, "ray buffer");
+	    return;
+	}
+    }
+
+    // what a checkpoint has to have been written for before it is resumed
+    std::ostringstream run;
+    run << prefix;
+    for (int i = 0; i < argc; i++)
+	run << " " << argv[i];
+    run << "\n" << ((rays) ? "ray_file " + dinfo.in_ray_file + "\n" : gen.describe());
+    run << "shard " << dinfo.shard << "/" << dinfo.nshards << "\n";
+    run << "format " << dinfo.binary << dinfo.compact << dinfo.compress << dinfo.region_ids << dinfo.digest
+	<< " " << std::setprecision(17) << dinfo.tol << " " << dinfo.digest_detail_file << "\n";
+    uint64_t run_id = 0x9e3779b97f4a7c15ULL;
+    for (char ch : run.str())
+	run_id = shotdigest::combine(run_id, (unsigned char)ch);
+
+    // start streaming output; erases any existing contents (unless resuming)
+    if (!tsj::Writer::Collector::open(out_config, nthreads, run_id)) {
+	destructor(base_inst);
+	if (rays)
+	    bu_free(rays, "ray buffer");
+	return;
+    }
+
+    /* multithreading? */
+    // one context (application + resource) per thread, made by that thread
+    std::vector<std::unique_ptr<DiffThreadContext>> contexts(nthreads);
+    struct ThreadArgs {
+	std::vector<std::unique_ptr<DiffThreadContext>>& contexts;
+	struct application* base_app;
+	struct xray* rays;	// ray list, or NULL to generate
+	const RayGenerator* gen;
+	int64_t total_rays;
+	int64_t first_ray;	// this run's (shard's) rays: [first_ray, end_ray)
+	int64_t end_ray;
+	int64_t done_chunks;	// resumed runs: chunks already written
+	int nthreads;
+	void (*shoot)(void*, struct xray*);
+	bool ordered;
+	int64_t view_rays;	// rays per generated view; 0 for ray lists
+	int64_t positions;	// progressive runs: positions to shoot (0: rays in index order)
+	int64_t deadline;	// bu_gettime() to stop claiming chunks at (0: none)
+	alignas(CACHE_LINE_BYTES) std::atomic<int64_t> next_chunk;	// the one line threads share on purpose
+    } targs { contexts, base_app, rays, &gen, total_rays, first_ray, end_ray,
+	      (int64_t)tsj::Writer::Collector::resumedChunks(), nthreads, shoot, dinfo.ordered,
+	      (rays) ? 0 : gen.view_rays, positions, 0, {0} };
+
+    /* Threads claim small chunks of rays from a shared counter until none
+     * are left, so a thread that draws an expensive stretch of a view does
+     * not hold up the others.  Chunks do not straddle views, so the result
+     * tree of an ordered run can group them by view, and a shard takes the
+     * chunks overlapping its rays (so shard boundaries need not line up) */
+    auto worker = [](int cpu, void* data) {
+	cpu--;	// cpu is 1-indexed
+
+	// unpack data
+	ThreadArgs* ta = (ThreadArgs*) data;
+	int64_t start_time = bu_gettime();
+
+	// first touch: set up this thread's context (thread 0 reuses the base resource)
+	if (!ta->contexts[cpu]) {
+	    std::unique_ptr<DiffThreadContext> ctx(new DiffThreadContext);
+	    ctx->app = *ta->base_app;
+	    if (cpu) {
+		ctx->app.a_resource = (struct resource *)bu_calloc(1, sizeof(struct resource), "resource");
+		rt_init_resource(ctx->app.a_resource, cpu, ctx->app.a_rt_i);
+	    }
+	    ctx->writer = &tsj::Writer::instance();
+	    ta->contexts[cpu] = std::move(ctx);
+	}
+	DiffThreadContext &ctx = *ta->contexts[cpu];
+
+	int64_t chunk_rays = (ta->ordered) ? ORDERED_CHUNK_RAYS : DIFF_CHUNK_RAYS;
+	int64_t span = (ta->view_rays) ? ta->view_rays : std::max<int64_t>(ta->total_rays, 1);
+	int64_t per_span = (span + chunk_rays - 1) / chunk_rays;
+	auto chunk_of = [&](int64_t i) { return (i / span) * per_span + (i % span) / chunk_rays; };
+	int64_t first_chunk = chunk_of(ta->first_ray);
+	int64_t end_chunk = (ta->end_ray > ta->first_ray) ? chunk_of(ta->end_ray - 1) + 1 : first_chunk;
+	if (ta->positions)
+	    end_chunk = (ta->positions + chunk_rays - 1) / chunk_rays;
+
+	tsj::Writer &writer = *ctx.writer;
+	struct xray ray;
+	int64_t c;
+	while (true) {
+	    // out of time: stop claiming - every claimed chunk is finished, so
+	    // what was shot is a prefix of the chunks
+	    if (ta->deadline && bu_gettime() >= ta->deadline)
+		break;
+	    if ((c = first_chunk + ta->done_chunks + ta->next_chunk.fetch_add(1)) >= end_chunk)
+		break;
+
+	    // progressive runs: chunks of positions, holes skipped
+	    if (ta->positions) {
+		writer.beginChunk(c);
+		for (int64_t p = c * chunk_rays; p < std::min((c + 1) * chunk_rays, ta->positions); p++) {
+		    int64_t i = ta->gen->position(p);
+		    if (i < 0)
+			continue;
+		    writer.setRayId(i, (int)(i / ta->view_rays));
+		    ta->gen->ray(i, &ray);
+		    ta->shoot((void*)&ctx.app, &ray);
+		    ctx.rays++;
+		}
+		writer.endChunk();
+		ctx.chunks++;
+		continue;
+	    }
+
+	    int64_t start = std::max((c / per_span) * span + (c % per_span) * chunk_rays, ta->first_ray);
+	    int64_t end = std::min({(c / per_span) * span + (c % per_span + 1) * chunk_rays, (c / per_span + 1) * span, ta->end_ray});
+
+	    // ordered output: chunks go out in ray order, so the writer only
+	    // ever has to hold the few chunks currently in flight
+	    if (ta->ordered)
+		writer.beginChunk(c - first_chunk);
+	    for (int64_t i = start; i < end; i++) {
+		writer.setRayId(i, (ta->view_rays) ? (int)(i / ta->view_rays) : -1);
+		if (ta->rays) {
+		    ta->shoot((void*)&ctx.app, &ta->rays[i]);
+		    continue;
+		}
+		ta->gen->ray(i, &ray);
+		ta->shoot((void*)&ctx.app, &ray);
+	    }
+	    if (ta->ordered)
+		writer.endChunk();
+	    ctx.rays += std::max<int64_t>(end - start, 0);
+	    ctx.chunks++;
+	}
+
+	// make sure thread collection buffer is synced
+	writer.syncToGlobal();
+
+	ctx.busy_usec = bu_gettime() - start_time;
+    };
+
+    /* do the work */
+    int64_t run_start = bu_gettime();
+    if (positions && gen.prefix < 0 && dinfo.budget_seconds > 0)
+	targs.deadline = run_start + (int64_t)(dinfo.budget_seconds * 1e6);
+    if (nthreads < 2)
+	worker(1, &targs);  // serial
+    else
+	bu_parallel(worker, nthreads, (void*)&targs);
+    int64_t run_usec = bu_gettime() - run_start;
+
+    // write out whatever is still queued
+    tsj::Writer::Collector::close();
+
+    // how far a budgeted run got goes into its ray file for the second build
+    if (targs.deadline) {
+	int64_t reached = std::min(targs.next_chunk.load() * (int64_t)ORDERED_CHUNK_RAYS, positions);
+	if (reached < positions) {
+	    gen.prefix = reached;
+	    if (gen.write(dinfo.ray_file))
+		std::cout << "Time budget of " << dinfo.budget_seconds << "s ran out after " << reached << " of " << positions
+			  << " ray positions; " << dinfo.ray_file << " records how far, for the second build's --input-rays\n";
+	}
+    }
+
+    // load balance: idle is time a thread spent waiting on the slowest one
+    std::cout << std::fixed << std::setprecision(3);
+    if (dinfo.nshards > 1)
+	std::cout << "Shard " << dinfo.shard << " of " << dinfo.nshards << ": rays " << first_ray << " - " << end_ray << " written to " << out_config.json_ofile << "\n";
+    int64_t shot_rays = 0;
+    for (int i = 0; i < nthreads; i++)
+	shot_rays += (contexts[i]) ? contexts[i]->rays : 0;
+    if (targs.done_chunks)
+	std::cout << "Resumed after " << targs.done_chunks << " chunks found complete in " << out_config.json_ofile << "\n";
+    std::cout << "Shot " << shot_rays << " rays in " << run_usec / 1e6 << "s on " << nthreads << " thread(s)\n";
+    for (int i = 0; i < nthreads; i++) {
+	if (!contexts[i])
+	    continue;
+	const DiffThreadContext &ctx = *contexts[i];
+	std::cout << "\tthread " << i << ": " << ctx.rays << " rays in " << ctx.chunks << " chunks, busy "
+		  << ctx.busy_usec / 1e6 << "s, idle " << std::max<int64_t>(run_usec - ctx.busy_usec, 0) / 1e6 << "s\n";
+    }
+
+    /* cleanup */
+    for (int i = 1; i < nthreads; i++) {
+	if (!contexts[i])
+	    continue;
+	rt_clean_resource(contexts[i]->app.a_rt_i, contexts[i]->app.a_resource);
+	bu_free(contexts[i]->app.a_resource, "resource");
+    }
+    destructor(base_inst);
+    if (rays)
+	bu_free(rays, "ray buffer");
 }
 
+
+/* pair runs: most rays along either side of one refinement grid */
+#define REFINE_MAX_SIDE 65
+/* pair runs: most difference areas refined (those with the most differing rays) */
+#define REFINE_MAX_AREAS 64
+
+/*
+ * Differing rays of one direction whose origins lie within two spacings
+ * of each other.  Positions are measured across the direction along the
+ * avec/bvec a generated view uses, from the origin of the first ray
+ */
+struct DiffArea {
+    int view = -1;
+    point_t origin;
+    vect_t dir, avec, bvec;
+    size_t nseeds = 0;		// differing rays of the run in the area
+    double lo[2], hi[2];	// extent of the differing rays along avec, bvec
+    double spacing = 0;		// grid spacing the extent was last narrowed down at (0: never)
+    size_t ndiff = 0;		// differing rays of that grid ...
+    size_t nrays = 0;		// ... out of this many
+    bool capped = false;	// stopped: the next grid would have been too large
+    bool open = false;		// differing rays reached the edge of the last grid
+    std::vector<Shot::Ray> rays;	// differing rays of the last grid
+};
+
 /*
- *  Helper Function to load or create array of rays to fire
+ * Shoot ever denser grids around each area of differing rays through both
+ * engines (reshoot() returns which rays of a batch differ) and report how
+ * far each area extends.  Level L samples at spacing / 2^L across the
+ * extent found so far plus one coarser spacing all round, and grows the
+ * grid while differing rays reach its edge.
  */
-struct xray* create_ray_array(int* total_rays, int rays_per_view, 
-			      std::string in_ray_file, std::string out_ray_file,
-			      point_t* bbox, double radius) {
-    struct xray* rays = (struct xray *)bu_malloc(sizeof(struct xray) * *total_rays, "allocating ray space");
+static void
+refine_differences(const std::vector<Shot>& differing, double spacing, int levels,
+		   const std::function<void(std::vector<struct xray>&, std::vector<int64_t>&)>& reshoot,
+		   const CompareConfig& dinfo)
+{
+    // group by direction ...
+    std::map<std::vector<int64_t>, std::vector<size_t>> by_dir;
+    for (size_t i = 0; i < differing.size(); i++) {
+	const Shot::Ray& r = differing[i].ray;
+	by_dir[{std::llround(r.dir[X] * 1e9), std::llround(r.dir[Y] * 1e9), std::llround(r.dir[Z] * 1e9)}].push_back(i);
+    }
 
-    if (!in_ray_file.empty()) {
-	// open file
-	std::ifstream rayfile(in_ray_file, std::ios::binary);
-	if (!rayfile.is_open()) {
-	    std::cerr << "failed to open ray_file: " << in_ray_file << std::endl;
-	    return NULL;
+    // ... then join rays in neighbouring cells two spacings wide
+    std::vector<DiffArea> areas;
+    for (auto const& [key, seeds] : by_dir) {
+	DiffArea base;
+	const Shot::Ray& first = differing[seeds[0]].ray;
+	VMOVE(base.origin, first.pt);
+	VMOVE(base.dir, first.dir);
+	VUNITIZE(base.dir);
+	bn_vec_ortho(base.avec, base.dir);
+	VCROSS(base.bvec, base.dir, base.avec);
+	VUNITIZE(base.bvec);
+
+	std::vector<std::array<double, 2>> pos(seeds.size());
+	std::map<std::pair<int64_t, int64_t>, std::vector<size_t>> cells;
+	for (size_t s = 0; s < seeds.size(); s++) {
+	    vect_t d;
+	    VSUB2(d, differing[seeds[s]].ray.pt, base.origin);
+	    pos[s] = {VDOT(d, base.avec), VDOT(d, base.bvec)};
+	    cells[{(int64_t)std::floor(pos[s][0] / (2 * spacing)), (int64_t)std::floor(pos[s][1] / (2 * spacing))}].push_back(s);
+	}
+	std::vector<size_t> parent(seeds.size());
+	for (size_t s = 0; s < seeds.size(); s++)
+	    parent[s] = s;
+	std::function<size_t(size_t)> root = [&](size_t s) { return (parent[s] == s) ? s : (parent[s] = root(parent[s])); };
+	for (auto const& [cell, members] : cells) {
+	    for (int64_t da = -1; da <= 1; da++) {
+		for (int64_t db = -1; db <= 1; db++) {
+		    auto it = cells.find({cell.first + da, cell.second + db});
+		    if (it == cells.end())
+			continue;
+		    for (size_t s : it->second)
+			parent[root(s)] = root(members[0]);
+		}
+	    }
 	}
 
-	// parse, load into array
-	int ray_idx = 0;
-	std::string line;
-	bool in_section = false;
-	while (std::getline(rayfile, line)) {
-	    // trim leading/trailing whitespace
-	    line.erase(0, line.find_first_not_of(" \t"));
-	    line.erase(line.find_last_not_of(" \t") + 1);
-
-	    if (in_section) {
-		std::istringstream iss(line);
-		std::string prefix;
-		double x, y, z;
-		// assumes line is point: xyz 123.4 234.5 345.6
-		//	    or direction: dir 123.4 234.5 345.6
-		iss >> prefix >> x >> y >> z;
-
-		if (prefix == "xyz") {
-		    rays[ray_idx].r_pt[0] = x;
-		    rays[ray_idx].r_pt[1] = y;
-		    rays[ray_idx].r_pt[2] = z;
-		} else {
-		    // assume this is 'dir' line
-		    rays[ray_idx].r_dir[0] = x;
-		    rays[ray_idx].r_dir[1] = y;
-		    rays[ray_idx].r_dir[2] = z;
-
-		    // got dir; next ray's up
-		    ray_idx++;
-		}
-	    } else if (line.rfind("**", 0) == 0) {  // check for section start
-		if (in_section)
+	std::map<size_t, size_t> area_of;	// root -> index into areas
+	for (size_t s = 0; s < seeds.size(); s++) {
+	    size_t r = root(s);
+	    auto it = area_of.find(r);
+	    if (it == area_of.end()) {
+		it = area_of.emplace(r, areas.size()).first;
+		areas.push_back(base);
+		areas.back().view = differing[seeds[s]].view;
+		areas.back().lo[0] = areas.back().hi[0] = pos[s][0];
+		areas.back().lo[1] = areas.back().hi[1] = pos[s][1];
+	    }
+	    DiffArea& a = areas[it->second];
+	    a.nseeds++;
+	    for (int k = 0; k < 2; k++) {
+		a.lo[k] = std::min(a.lo[k], pos[s][k]);
+		a.hi[k] = std::max(a.hi[k], pos[s][k]);
+	    }
+	}
+    }
+    std::stable_sort(areas.begin(), areas.end(), [](const DiffArea& l, const DiffArea& r) { return l.nseeds > r.nseeds; });
+    size_t skipped = (areas.size() > REFINE_MAX_AREAS) ? areas.size() - REFINE_MAX_AREAS : 0;
+    areas.resize(areas.size() - skipped);
+
+    int64_t shot = 0;
+    std::vector<struct xray> batch;
+    std::vector<int64_t> diff;
+    for (DiffArea& a : areas) {
+	for (int level = 1; level <= levels && !a.capped; level++) {
+	    double h = std::ldexp(spacing, -level);
+	    double margin = 2 * h;
+	    double lo[2] = {a.lo[0] - margin, a.lo[1] - margin};
+	    double hi[2] = {a.hi[0] + margin, a.hi[1] + margin};
+	    bool vanished = false;
+	    for (int grow = 0; grow < 8; grow++) {
+		int64_t n[2];
+		for (int k = 0; k < 2; k++)
+		    n[k] = (int64_t)std::ceil((hi[k] - lo[k]) / h) + 1;
+		if (n[0] > REFINE_MAX_SIDE || n[1] > REFINE_MAX_SIDE) {
+		    a.capped = true;
+		    break;
+		}
+
+		batch.resize(n[0] * n[1]);
+		for (int64_t i = 0; i < n[0]; i++) {
+		    for (int64_t j = 0; j < n[1]; j++) {
+			struct xray& r = batch[i * n[1] + j];
+			r.magic = RT_RAY_MAGIC;
+			r.index = (size_t)(i * n[1] + j);
+			VJOIN2(r.r_pt, a.origin, lo[0] + i * h, a.avec, lo[1] + j * h, a.bvec);
+			VMOVE(r.r_dir, a.dir);
+		    }
+		}
+		reshoot(batch, diff);
+		shot += (int64_t)batch.size();
+
+		// nothing at this spacing: the difference is narrower than the grid
+		if (diff.empty()) {
+		    vanished = true;
 		    break;
+		}
+		int64_t dlo[2] = {n[0], n[1]}, dhi[2] = {-1, -1};
+		a.rays.clear();
+		for (int64_t k : diff) {
+		    int64_t ij[2] = {k / n[1], k % n[1]};
+		    for (int c = 0; c < 2; c++) {
+			dlo[c] = std::min(dlo[c], ij[c]);
+			dhi[c] = std::max(dhi[c], ij[c]);
+		    }
+		    Shot::Ray ray(0.0);
+		    VMOVE(ray.pt, batch[k].r_pt);
+		    VMOVE(ray.dir, batch[k].r_dir);
+		    a.rays.push_back(ray);
+		}
+		for (int c = 0; c < 2; c++) {
+		    a.lo[c] = lo[c] + dlo[c] * h;
+		    a.hi[c] = lo[c] + dhi[c] * h;
+		}
+		a.spacing = h;
+		a.ndiff = diff.size();
+		a.nrays = batch.size();
 
-		// extract amount of rays from section header
-		size_t startIdx = line.find('[');
-		size_t endIdx = line.find(']');
-		if (startIdx != std::string::npos && endIdx != std::string::npos) {
-		    // assume number in bracket is number of rays we need to read
-		    int num_rays = stoi(line.substr(startIdx + 1, endIdx - startIdx - 1));
-
-		    // ray file has more rays than we were expecting
-		    if (num_rays > *total_rays) {
-			rays = (struct xray*)bu_realloc(rays, sizeof(struct xray) * num_rays, "realloc ray space");
-			*total_rays = num_rays;
+		// differing rays on the edge: the area goes on past the grid
+		bool &edge = a.open;
+		edge = false;
+		for (int c = 0; c < 2; c++) {
+		    if (dlo[c] == 0) {
+			lo[c] -= margin;
+			edge = true;
+		    }
+		    if (dhi[c] == n[c] - 1) {
+			hi[c] += margin;
+			edge = true;
 		    }
 		}
-		in_section = true;
+		if (!edge)
+		    break;
 	    }
+	    if (vanished)
+		break;
 	}
-    } else {
-	// TODO: better and/or random dirs?
-	static vect_t dir[NUMVIEWS] = {
-	    {0,0,1}, {0,1,0}, {1,0,0},			/* axis */
-	    {1,1,1}, {1,4,-1}, {-1,-2,4}		/* non-axis */
-	};
-	for(int i = 0; i < NUMVIEWS; ++i) VUNITIZE(dir[i]);	/* normalize the dirs */
+    }
+
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout << std::setprecision(6);
+    std::cout << "Refined " << areas.size() << " difference area(s) with " << shot << " rays, " << levels
+	      << " level(s) down from spacing " << spacing << "\n";
+    if (skipped)
+	std::cout << "\t(" << skipped << " smaller area(s) not refined)\n";
+    std::vector<Shot::Ray> refined;
+    for (size_t i = 0; i < areas.size(); i++) {
+	const DiffArea& a = areas[i];
+	std::cout << "\tarea " << i;
+	if (a.view >= 0)
+	    std::cout << " (view " << a.view << ")";
+	std::cout << ": " << a.nseeds << " differing ray(s) in the run; ";
+	double h = a.spacing;	// each grid ray stands for a cell this wide
+	std::cout << ((a.open) ? "at least " : "") << (a.hi[0] - a.lo[0] + h) << " x " << (a.hi[1] - a.lo[1] + h) << " along avec x bvec";
+	if (a.spacing > 0)
+	    std::cout << ", ~" << a.ndiff * h * h << " square units (" << a.ndiff << " of " << a.nrays << " rays differ at spacing " << h << ")";
+	else
+	    std::cout << " (not refined)";
+	if (a.capped)
+	    std::cout << ", too wide for a finer grid";
+	std::cout << "\n";
+	point_t centre;
+	VJOIN2(centre, a.origin, (a.lo[0] + a.hi[0]) / 2, a.avec, (a.lo[1] + a.hi[1]) / 2, a.bvec);
+	std::cout << "\t\txyz " << centre[X] << " " << centre[Y] << " " << centre[Z]
+		  << " dir " << a.dir[X] << " " << a.dir[Y] << " " << a.dir[Z] << "\n";
+	for (const Shot::Ray& ray : a.rays)
+	    refined.push_back(ray);
+    }
 
-	/* build the views with pre-defined rays, yo */
-	int rays_per_ring = 100;
-	for(int j=0; j < NUMVIEWS; ++j) {
-	    vect_t avec, bvec;
+    // the finest differing rays found, ready for nirt or --input-rays
+    std::filesystem::path nirt(dinfo.nirt_file);
+    std::string path = (nirt.parent_path() / (nirt.stem().string() + ".refined" + nirt.extension().string())).string();
+    std::ofstream out(path, std::ios::out);
+    out << "** differing shots [" << refined.size() << "] **\n";
+    out << std::fixed << std::setprecision(17);
+    for (const Shot::Ray& ray : refined) {
+	out << "xyz " << ray.pt[X] << " " << ray.pt[Y] << " " << ray.pt[Z] << "\n" <<
+	       "dir " << ray.dir[X] << " " << ray.dir[Y] << " " << ray.dir[Z] << "\n";
+    }
+    if (!refined.empty())
+	std::cout << "See " << path << " for the differing rays of the finest grids.\n";
+}
+
+void
+do_diff_pair_run(int argc, const char **argv, int nthreads, int64_t rays_per_view,
+	const DiffEngine& a, const AppConfig& acfg_a,
+	const DiffEngine& b, const AppConfig& acfg_b,
+	CompareConfig& dinfo)
+{
+    nthreads = (nthreads == 0) ? bu_avail_cpus() : nthreads;	// 0 implies maximize cpu
 
-	    // add accuracy ray in before bundle
-	    int acc_idx = j * (rays_per_view +1);
-	    VMOVE(rays[acc_idx].r_dir,dir[j]);
-	    VJOIN1(rays[acc_idx].r_pt, bbox[2], -radius, dir[j]);
+    // b's differing shots go next to a's: shots.json -> shots.b.json
+    std::filesystem::path path_a(dinfo.json_ofile);
+    std::string file_b = (path_a.parent_path() / (path_a.stem().string() + ".b" + path_a.extension().string())).string();
 
-	    /* set up an othographic grid */
-	    bn_vec_ortho( avec, rays[acc_idx].r_dir );
-	    VCROSS( bvec, rays[acc_idx].r_dir, avec );
-	    VUNITIZE( bvec );
-	    rt_raybundle_maker(rays + acc_idx, radius, avec, bvec, rays_per_ring, rays_per_view/rays_per_ring);
+    /* one instance of each engine, prepped side by side */
+    void* inst_a = a.constructor(*argv, argc-1, argv+1, dinfo.json_ofile, acfg_a);
+    if (inst_a == NULL)
+	return;
+    void* inst_b = b.constructor(*argv, argc-1, argv+1, file_b, acfg_b);
+    if (inst_b == NULL) {
+	a.destructor(inst_a);
+	return;
+    }
+
+    // both shoot the rays laid out around a's model
+    RayGenerator gen;
+    struct xray* rays = NULL;	// MUST FREE
+    int64_t total_rays = 0;
+    if (!diff_run_rays(inst_a, rays_per_view, a.getbox, a.getsize, dinfo, gen, &rays, &total_rays)) {
+	a.destructor(inst_a);
+	b.destructor(inst_b);
+	return;
+    }
+
+    std::vector<std::unique_ptr<PairThreadContext>> contexts(nthreads);
+    struct ThreadArgs {
+	std::vector<std::unique_ptr<PairThreadContext>>& contexts;
+	struct application* base_a;
+	struct application* base_b;
+	struct xray* rays;	// ray list, or NULL to generate
+	const RayGenerator* gen;
+	int64_t total_rays;
+	void (*shoot_a)(void*, struct xray*);
+	void (*shoot_b)(void*, struct xray*);
+	double tol;
+	bool compare_derived;
+	int64_t view_rays;	// rays per generated view; 0 for ray lists
+	alignas(CACHE_LINE_BYTES) std::atomic<int64_t> next_chunk;
+    } targs { contexts, (struct application*)inst_a, (struct application*)inst_b, rays, &gen, total_rays,
+	      a.shoot, b.shoot, dinfo.tol, dinfo.compare_derived, (rays) ? 0 : gen.view_rays, {0} };
+
+    /* Each ray is shot through a, then b, into shots held by the thread -
+     * the writer records them instead of writing them out - and compared
+     * on the spot.  Only differing pairs are kept */
+    auto worker = [](int cpu, void* data) {
+	cpu--;	// cpu is 1-indexed
+
+	ThreadArgs* ta = (ThreadArgs*) data;
+	int64_t start_time = bu_gettime();
+
+	// first touch: this thread's applications (thread 0 reuses the base resources)
+	if (!ta->contexts[cpu]) {
+	    std::unique_ptr<PairThreadContext> ctx(new PairThreadContext);
+	    ctx->app_a = *ta->base_a;
+	    ctx->app_b = *ta->base_b;
+	    if (cpu) {
+		for (struct application* app : {&ctx->app_a, &ctx->app_b}) {
+		    app->a_resource = (struct resource *)bu_calloc(1, sizeof(struct resource), "resource");
+		    rt_init_resource(app->a_resource, cpu, app->a_rt_i);
+		}
+	    }
+	    ta->contexts[cpu] = std::move(ctx);
 	}
+	PairThreadContext &ctx = *ta->contexts[cpu];
 
-	// write all the ray info
-	// TODO: do this in dry-run?
-	// TODO: write in chunks
-	FILE* ray_file = fopen(out_ray_file.c_str(), "w");	// intentionally erase contents if file already exists
-	fprintf(ray_file, "**rays fired for %s [%d]**\n", out_ray_file.c_str(), *total_rays);
-	for (int i = 0; i < *total_rays; i++) {
-	    fprintf(ray_file, "xyz %0.17f %0.17f %0.17f\ndir %0.17f %0.17f %0.17f\n", V3ARGS(rays[i].r_pt), V3ARGS(rays[i].r_dir));
+	tsj::Writer &writer = tsj::Writer::instance();
+	struct xray ray;
+	int64_t c;
+	while ((c = ta->next_chunk.fetch_add(1)) * DIFF_CHUNK_RAYS < ta->total_rays) {
+	    int64_t start = c * DIFF_CHUNK_RAYS;
+	    int64_t end = std::min(start + DIFF_CHUNK_RAYS, ta->total_rays);
+	    for (int64_t i = start; i < end; i++) {
+		struct xray* r = &ray;
+		if (ta->rays)
+		    r = &ta->rays[i];
+		else
+		    ta->gen->ray(i, &ray);
+		int view = (ta->view_rays) ? (int)(i / ta->view_rays) : -1;
+
+		writer.setRayId(i, view);
+		writer.beginCapture(&ctx.shot_a);
+		ta->shoot_a((void*)&ctx.app_a, r);
+		writer.setRayId(i, view);
+		writer.beginCapture(&ctx.shot_b);
+		ta->shoot_b((void*)&ctx.app_b, r);
+		writer.endCapture();
+
+		if (!shot_utils::shot_equal_at_tol(&ctx.shot_a, &ctx.shot_b, ta->tol, ta->compare_derived)) {
+		    ctx.diffs_a.push_back(ctx.shot_a);
+		    ctx.diffs_b.push_back(ctx.shot_b);
+		}
+	    }
+	    ctx.rays += end - start;
+	}
+
+	ctx.busy_usec = bu_gettime() - start_time;
+    };
+
+    /* do the work */
+    int64_t run_start = bu_gettime();
+    if (nthreads < 2)
+	worker(1, &targs);  // serial
+    else
+	bu_parallel(worker, nthreads, (void*)&targs);
+    int64_t run_usec = bu_gettime() - run_start;
+
+    // differing pairs in ray order, whichever thread found them
+    std::vector<std::pair<int64_t, const PairThreadContext*>> order;
+    std::vector<size_t> pos;
+    for (const std::unique_ptr<PairThreadContext>& ctx : contexts) {
+	if (!ctx)
+	    continue;
+	for (size_t i = 0; i < ctx->diffs_a.size(); i++) {
+	    order.emplace_back(ctx->diffs_a[i].idx, ctx.get());
+	    pos.push_back(i);
 	}
-	fclose(ray_file);
     }
+    std::vector<size_t> sorted(order.size());
+    for (size_t i = 0; i < sorted.size(); i++)
+	sorted[i] = i;
+    std::sort(sorted.begin(), sorted.end(), [&](size_t x, size_t y) { return order[x].first < order[y].first; });
 
-    return rays;
+    std::vector<Shot> diffs_a, diffs_b;
+    std::vector<Shot::Ray> differing;
+    std::map<int, size_t> view_diffs;
+    for (size_t s : sorted) {
+	const PairThreadContext* ctx = order[s].second;
+	diffs_a.push_back(ctx->diffs_a[pos[s]]);
+	diffs_b.push_back(ctx->diffs_b[pos[s]]);
+	differing.push_back(diffs_a.back().ray);
+	if (diffs_a.back().view >= 0)
+	    view_diffs[diffs_a.back().view]++;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Shot " << total_rays << " rays through " << a.prefix << " and " << b.prefix << " in " << run_usec / 1e6 << "s on " << nthreads << " thread(s)\n";
+    std::cout.unsetf(std::ios_base::floatfield);
+    std::cout << std::setprecision(6);
+    report_differing(differing, view_diffs, (size_t)total_rays, dinfo);
+
+    // just the differing shots, for a closer look (or -c against each other)
+    if (shotbin::writeShots(dinfo.json_ofile, diffs_a, dinfo.binary, dinfo.compact, dinfo.compress) &&
+	shotbin::writeShots(file_b, diffs_b, dinfo.binary, dinfo.compact, dinfo.compress) && !differing.empty())
+	std::cout << "Differing shots written to " << dinfo.json_ofile << " (" << a.prefix << ") and " << file_b << " (" << b.prefix << ")\n";
+
+    // how far do the differences reach?  re-shoot grids through both engines
+    if (dinfo.refine_levels > 0 && !diffs_a.empty()) {
+	auto reshoot = [&](std::vector<struct xray>& batch, std::vector<int64_t>& differ) {
+	    for (std::unique_ptr<PairThreadContext>& ctx : contexts) {
+		if (ctx) {
+		    ctx->diffs_a.clear();
+		    ctx->diffs_b.clear();
+		}
+	    }
+	    targs.rays = batch.data();
+	    targs.total_rays = (int64_t)batch.size();
+	    targs.view_rays = 0;
+	    targs.next_chunk = 0;
+	    if (nthreads < 2 || batch.size() <= DIFF_CHUNK_RAYS)
+		worker(1, &targs);
+	    else
+		bu_parallel(worker, nthreads, (void*)&targs);
+	    differ.clear();
+	    for (const std::unique_ptr<PairThreadContext>& ctx : contexts) {
+		if (ctx) {
+		    for (const Shot& s : ctx->diffs_a)
+			differ.push_back(s.idx);
+		}
+	    }
+	};
+	// ray lists say nothing of their spacing; take that of a generated run
+	// of as many rays per view
+	double spacing = gen.spacing();
+	if (rays) {
+	    RayGenerator like;
+	    point_t origin = VINIT_ZERO;
+	    like.init(rays_per_view, origin, a.getsize(inst_a));
+	    spacing = like.spacing();
+	}
+	refine_differences(diffs_a, spacing, dinfo.refine_levels, reshoot, dinfo);
+    }
+
+    /* cleanup */
+    for (int i = 1; i < nthreads; i++) {
+	if (!contexts[i])
+	    continue;
+	for (struct application* app : {&contexts[i]->app_a, &contexts[i]->app_b}) {
+	    rt_clean_resource(app->a_rt_i, app->a_resource);
+	    bu_free(app->a_resource, "resource");
+	}
+    }
+    a.destructor(inst_a);
+    b.destructor(inst_b);
+    if (rays)
+	bu_free(rays, "ray buffer");
 }
 
+
 /*
- * TODO:
- *	* Shoot on a grid set instead of a single ray.
+ * Does the region path (/top/assembly/region.r) fall under name - the
+ * leading components of the path if name has a slash, else any one of them
  */
+static bool
+region_matches(const std::string& path, const std::string& name)
+{
+    if (name.find('/') != std::string::npos) {
+	std::string lead = (name[0] == '/') ? name : "/" + name;
+	while (lead.size() > 1 && lead.back() == '/')
+	    lead.pop_back();
+	return path.compare(0, lead.size(), lead) == 0 && (path.size() == lead.size() || path[lead.size()] == '/');
+    }
+    for (size_t start = 0; start <= path.size();) {
+	size_t end = std::min(path.find('/', start), path.size());
+	if (end - start == name.size() && path.compare(start, end - start, name) == 0)
+	    return true;
+	start = end + 1;
+    }
+    return false;
+}
+
+/* does the line of the ray cross the box?  Either way along it, so nothing
+ * behind a ray's origin is missed */
+static bool
+line_crosses_box(const Shot::Ray& r, const point_t min, const point_t max)
+{
+    double tmin = -std::numeric_limits<double>::infinity();
+    double tmax = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < 3; i++) {
+	if (ZERO(r.dir[i])) {
+	    if (r.pt[i] < min[i] || r.pt[i] > max[i])
+		return false;
+	    continue;
+	}
+	double t1 = (min[i] - r.pt[i]) / r.dir[i];
+	double t2 = (max[i] - r.pt[i]) / r.dir[i];
+	tmin = std::max(tmin, std::min(t1, t2));
+	tmax = std::min(tmax, std::max(t1, t2));
+	if (tmin > tmax)
+	    return false;
+    }
+    return true;
+}
+
+/* What --changed-since compares between the two databases, by name: a hash
+ * of everything under each region, and a hash of each assembly's own record.
+ * An assembly record holds its members and their matrices, so moving or
+ * re-booleaning anything above a region shows up there, not in the region */
+struct TreeHashes {
+    std::map<std::string, unsigned long long> regions;
+    std::map<std::string, unsigned long long> assemblies;
+};
+
+/* db_functree() callbacks: fold every object under a region into its hash,
+ * hash each region and assembly found under a top level object, and gather
+ * the regions under an object */
+static void
+hash_object(struct db_i *dbip, struct directory *dp, void *data)
+{
+    unsigned long long *hash = (unsigned long long *)data;
+    struct bu_external ext;
+    if (db_get_external(&ext, dp, dbip) < 0)
+	return;
+    *hash = shotdigest::combine(*hash, bu_data_hash(ext.ext_buf, ext.ext_nbytes));
+    bu_free_external(&ext);
+}
+
+static void
+hash_comb(struct db_i *dbip, struct directory *dp, void *data)
+{
+    TreeHashes *t = (TreeHashes *)data;
+    unsigned long long hash = 0x9e3779b97f4a7c15ULL;
+    if (!(dp->d_flags & RT_DIR_REGION)) {
+	hash_object(dbip, dp, &hash);
+	t->assemblies[dp->d_namep] = hash;
+	return;
+    }
+    if (t->regions.count(dp->d_namep))
+	return;
+    db_functree(dbip, dp, hash_object, hash_object, &rt_uniresource, &hash);
+    t->regions[dp->d_namep] = hash;
+}
+
+static void
+collect_region(struct db_i *, struct directory *dp, void *data)
+{
+    if (dp->d_flags & RT_DIR_REGION)
+	((std::set<std::string> *)data)->insert(dp->d_namep);
+}
+
+static struct db_i *
+open_tree(const char *file)
+{
+    struct db_i *dbip = db_open(file, DB_OPEN_READONLY);
+    if (dbip == DBI_NULL) {
+	std::cerr << "failed to open database: " << file << std::endl;
+	return DBI_NULL;
+    }
+    if (db_dirbuild(dbip) < 0) {
+	std::cerr << "failed to read the directory of " << file << std::endl;
+	db_close(dbip);
+	return DBI_NULL;
+    }
+    return dbip;
+}
+
+/* the regions under the top level objects that differ between the two
+ * databases: those whose own objects changed, those only one of them has,
+ * and every region under an assembly whose record changed.  Objects missing
+ * from a file are skipped */
+static bool
+changed_since(const char *old_file, const char *new_file, int nobjs, const char **objs,
+	std::set<std::string>& changed)
+{
+    struct db_i *dbs[2];
+    if ((dbs[0] = open_tree(old_file)) == DBI_NULL)
+	return false;
+    if ((dbs[1] = open_tree(new_file)) == DBI_NULL) {
+	db_close(dbs[0]);
+	return false;
+    }
+
+    TreeHashes h[2];
+    for (int d = 0; d < 2; d++) {
+	for (int i = 0; i < nobjs; i++) {
+	    struct directory *dp = db_lookup(dbs[d], objs[i], LOOKUP_QUIET);
+	    if (dp != RT_DIR_NULL)
+		db_functree(dbs[d], dp, hash_comb, NULL, &rt_uniresource, &h[d]);
+	}
+    }
+
+    for (int d = 0; d < 2; d++) {
+	const TreeHashes& a = h[d];
+	const TreeHashes& b = h[1-d];
+	for (const auto& r : a.regions) {
+	    auto o = b.regions.find(r.first);
+	    if (o == b.regions.end() || o->second != r.second)
+		changed.insert(r.first);
+	}
+	// a moved or re-combined assembly changes what is under it in both
+	for (const auto& c : a.assemblies) {
+	    auto o = b.assemblies.find(c.first);
+	    if (o != b.assemblies.end() && o->second == c.second)
+		continue;
+	    for (int e = 0; e < 2; e++) {
+		struct directory *dp = db_lookup(dbs[e], c.first.c_str(), LOOKUP_QUIET);
+		if (dp != RT_DIR_NULL)
+		    db_functree(dbs[e], dp, collect_region, NULL, &rt_uniresource, &changed);
+	    }
+	}
+    }
+
+    db_close(dbs[0]);
+    db_close(dbs[1]);
+    return true;
+}
+
 void
-do_diff_run(const char *prefix, int argc, const char **argv, int nthreads, int rays_per_view,
-	void *(*constructor) (const char *, int, const char **, std::string),
-	int (*getbox) (void *, point_t *, point_t *),
-	double (*getsize) (void *),
-	void (*shoot) (void *, struct xray * ray),
-	int (*destructor) (void *),
-	CompareConfig& dinfo)
+do_diff_update_run(int argc, const char **argv, int nthreads, const DiffEngine& e,
+	CompareConfig& dinfo, const AppConfig& acfg)
 {
-    int total_rays = NUMVIEWS * (rays_per_view + 1);		// rays per view + 1 accuracy ray per view
     nthreads = (nthreads == 0) ? bu_avail_cpus() : nthreads;	// 0 implies maximize cpu
 
-    /* base instance for this run */
-    void* base_inst = constructor(*argv, argc-1, argv+1, dinfo.json_ofile);
-    if (base_inst == NULL) {
+    std::error_code ec;
+    if (std::filesystem::equivalent(dinfo.update_file, dinfo.json_ofile, ec)) {
+	std::cerr << "an update run cannot overwrite the results it updates: " << dinfo.json_ofile << std::endl;
 	return;
     }
 
-    struct application* base_app = (struct application*)base_inst;
+    // the changed regions: as given, or those that differ between the two
+    // databases, including ones only one of them has or whose placement
+    // changed in an assembly above them
+    std::vector<std::string> changed = dinfo.changed_regions;
+    if (!dinfo.changed_since.empty()) {
+	std::set<std::string> since;
+	if (!changed_since(dinfo.changed_since.c_str(), *argv, argc-1, argv+1, since))
+	    return;
+	changed.insert(changed.end(), since.begin(), since.end());
+	std::cout << since.size() << " region(s) changed since " << dinfo.changed_since << "\n";
+    }
+
+    // nothing changed: the earlier run is copied over without prepping
+    void* inst = NULL;
+    if (!changed.empty()) {
+	inst = e.constructor(*argv, argc-1, argv+1, dinfo.json_ofile, acfg);
+	if (inst == NULL)
+	    return;
+    }
 
-    // get these for ray generation
-    double radius = getsize(base_inst);
-    point_t bbox[3];
-    getbox(base_inst, bbox, bbox +1);
-    VADD2SCALE(bbox[2], bbox[0], bbox[1], 0.5);
-    // allocs expeceted rays; MUST FREE */
-    struct xray* rays = create_ray_array(&total_rays, rays_per_view, dinfo.in_ray_file, dinfo.ray_file, bbox, radius);
+    // where the changed regions are now; rays that crossed where they were
+    // before hit them, so their stored partitions say so
+    std::vector<std::array<double, 6>> boxes;
+    if (inst) {
+	struct rt_i* rtip = ((struct application*)inst)->a_rt_i;
+	std::vector<bool> found(changed.size(), false);
+	for (size_t i = 0; i < rtip->nregions; i++) {
+	    struct region* regp = rtip->Regions[i];
+	    if (regp == NULL)
+		continue;
+	    bool match = false;
+	    for (size_t c = 0; c < changed.size(); c++) {
+		if (region_matches(regp->reg_name, changed[c]))
+		    match = found[c] = true;
+	    }
+	    if (!match)
+		continue;
+	    point_t min, max;
+	    if (rt_bound_tree(regp->reg_treetop, min, max) < 0)
+		e.getbox(inst, &min, &max);	// unbounded: all of the model
+	    boxes.push_back({min[X], min[Y], min[Z], max[X], max[Y], max[Z]});
+	}
+	for (size_t c = 0; c < changed.size(); c++) {
+	    if (!found[c] && dinfo.changed_since.empty())
+		std::cerr << "changed region " << changed[c] << " matches no region of " << *argv << std::endl;
+	}
+    }
 
-    // prep file for writing; erase any existing contents with trunc
-    std::ofstream f(dinfo.json_ofile, std::ios::binary | std::ios::trunc);
+    ShotStream in;
+    if (!in.open(dinfo.update_file)) {
+	if (inst)
+	    e.destructor(inst);
+	return;
+    }
+    std::vector<std::string> region_table;
+    if (!shot_utils::is_pipe(dinfo.update_file))
+	shot_utils::read_region_table(dinfo.update_file, region_table);
 
-    /* multithreading? */
-    // we need one application* and resrouces per thread
-    std::vector<application> apps;
-    apps.reserve(nthreads);
-    apps.emplace_back(*base_app);
-    for (int i = 1; i < nthreads; i++) {
-	application thread_app = *base_app;
-	thread_app.a_resource = (struct resource *)bu_calloc(1, sizeof(struct resource), "resource");
-	rt_init_resource(thread_app.a_resource, i, thread_app.a_rt_i);
-	apps.emplace_back(thread_app);
+    shotbin::ShotFileWriter out;
+    if (!out.open(dinfo.json_ofile, dinfo.binary, dinfo.compact, dinfo.compress)) {
+	if (inst)
+	    e.destructor(inst);
+	return;
     }
+    // the updated file has none; do not let one from an earlier run stand
+    std::filesystem::remove(shotdigest::treePath(dinfo.json_ofile), ec);
+
+    std::vector<std::unique_ptr<UpdateThreadContext>> contexts(nthreads);
     struct ThreadArgs {
-	std::vector<application>& apps;
-	struct xray* rays;
-	int total_rays;
-	int nthreads;
+	std::vector<std::unique_ptr<UpdateThreadContext>>& contexts;
+	struct application* base_app;
+	std::vector<Shot>* shots;
+	std::vector<size_t> redo;	// which of the shots to re-shoot
+	int64_t first_ray;		// ray index of shots[0], for shots without one
 	void (*shoot)(void*, struct xray*);
-    } targs { apps, rays, total_rays, nthreads, shoot };
+	double tol;
+	alignas(CACHE_LINE_BYTES) std::atomic<int64_t> next_chunk;
+    } targs { contexts, (struct application*)inst, NULL, {}, 0, e.shoot, dinfo.tol, {0} };
 
+    /* Threads claim chunks of the rays to re-shoot, capture each into their
+     * own shot and swap its partitions into the earlier run's */
     auto worker = [](int cpu, void* data) {
 	cpu--;	// cpu is 1-indexed
-	
-	// reserve buffer for this thread
-	tsj::Writer::instance().reserve(100 * 1024 * 1024);  // approx 100MB per thread
 
-	// unpack data
 	ThreadArgs* ta = (ThreadArgs*) data;
-	
-	// split in contiguous blocks
-	int per = ta->total_rays / ta->nthreads;
-	int base = cpu * per;
-	// lazy - let our last thread handle extras from non-even divide
-	int end = (cpu == ta->nthreads - 1)
-		   ? ta->total_rays
-		   : base + per;
+	int64_t start_time = bu_gettime();
 
-	// do the shooting for this block of rays
-	for (int i = base; i < end; i++) {
-	    ta->shoot((void*)&ta->apps[cpu], &ta->rays[i]);
+	// first touch: this thread's application (thread 0 reuses the base resource)
+	if (!ta->contexts[cpu]) {
+	    std::unique_ptr<UpdateThreadContext> ctx(new UpdateThreadContext);
+	    ctx->app = *ta->base_app;
+	    if (cpu) {
+		ctx->app.a_resource = (struct resource *)bu_calloc(1, sizeof(struct resource), "resource");
+		rt_init_resource(ctx->app.a_resource, cpu, ctx->app.a_rt_i);
+	    }
+	    ta->contexts[cpu] = std::move(ctx);
 	}
+	UpdateThreadContext &ctx = *ta->contexts[cpu];
 
-	// make sure thread collection buffer is synced
-	tsj::Writer::instance().syncToGlobal();
+	tsj::Writer &writer = tsj::Writer::instance();
+	struct xray ray;
+	memset(&ray, 0, sizeof(ray));
+	ray.magic = RT_RAY_MAGIC;
+	int64_t c;
+	while ((c = ta->next_chunk.fetch_add(1)) * DIFF_CHUNK_RAYS < (int64_t)ta->redo.size()) {
+	    size_t start = c * DIFF_CHUNK_RAYS;
+	    size_t end = std::min(start + DIFF_CHUNK_RAYS, ta->redo.size());
+	    for (size_t k = start; k < end; k++) {
+		Shot& s = (*ta->shots)[ta->redo[k]];
+		VMOVE(ray.r_pt, s.ray.pt);
+		VMOVE(ray.r_dir, s.ray.dir);
+		ray.index = (size_t)((s.idx >= 0) ? s.idx : ta->first_ray + (int64_t)ta->redo[k]);
+
+		writer.setRayId(s.idx, s.view);
+		writer.beginCapture(&ctx.shot);
+		ta->shoot((void*)&ctx.app, &ray);
+		writer.endCapture();
+
+		if (!shot_utils::shot_equal_at_tol(&s, &ctx.shot, ta->tol))
+		    ctx.changed++;
+		std::swap(s.parts, ctx.shot.parts);
+		s.derived_pts = false;
+	    }
+	    ctx.rays += end - start;
+	}
+
+	ctx.busy_usec += bu_gettime() - start_time;
     };
 
-    /* do the work */
-    if (nthreads < 2)
-	worker(1, &targs);  // serial
+    /* Splice: read the earlier run a batch at a time, re-shoot the rays
+     * that touch or cross a changed region and write the batch out in its
+     * original order */
+    std::unordered_map<std::string, bool> touches;	// by region path
+    std::vector<Shot> batch, shots;
+    int64_t total_rays = 0, touching = 0, crossing = 0;
+    bool ok = true;
+    int64_t run_start = bu_gettime();
+    auto flush = [&]() {
+	targs.shots = &batch;
+	targs.redo.clear();
+	targs.first_ray = total_rays;
+	for (size_t i = 0; i < batch.size(); i++) {
+	    Shot& s = batch[i];
+	    bool touch = false;
+	    for (Shot::Partition& part : s.parts) {
+		if (part.region_id >= 0) {
+		    if ((size_t)part.region_id >= region_table.size()) {
+			std::cerr << dinfo.update_file << " has region ids but no region table to name them" << std::endl;
+			return false;
+		    }
+		    part.region = region_table[part.region_id];
+		    part.region_id = -1;
+		}
+		auto t = touches.find(part.region);
+		if (t == touches.end()) {
+		    bool match = false;
+		    for (const std::string& name : changed)
+			match = match || region_matches(part.region, name);
+		    t = touches.emplace(part.region, match).first;
+		}
+		touch = touch || t->second;
+	    }
+	    if (touch) {
+		touching++;
+		targs.redo.push_back(i);
+		continue;
+	    }
+	    for (const std::array<double, 6>& box : boxes) {
+		if (line_crosses_box(s.ray, &box[0], &box[3])) {
+		    crossing++;
+		    targs.redo.push_back(i);
+		    break;
+		}
+	    }
+	}
+	total_rays += (int64_t)batch.size();
+
+	targs.next_chunk = 0;
+	if (!targs.redo.empty()) {
+	    if (nthreads < 2 || targs.redo.size() <= DIFF_CHUNK_RAYS)
+		worker(1, &targs);  // serial
+	    else
+		bu_parallel(worker, nthreads, (void*)&targs);
+	}
+	bool written = out.write(batch);
+	batch.clear();
+	return written;
+    };
+    while (ok && in.next(shots)) {
+	for (Shot& s : shots)
+	    batch.push_back(std::move(s));
+	if (batch.size() >= UPDATE_BATCH_SHOTS)
+	    ok = flush();
+    }
+    if (ok && !batch.empty())
+	ok = flush();
+    ok = out.close() && ok && !in.failed();
+    int64_t run_usec = bu_gettime() - run_start;
+
+    int64_t changed_rays = 0;
+    for (const std::unique_ptr<UpdateThreadContext>& ctx : contexts)
+	changed_rays += (ctx) ? ctx->changed : 0;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Re-shot " << touching + crossing << " of " << total_rays << " rays (" << touching << " touched changed regions, "
+	      << crossing << " more cross their bounding boxes) in " << run_usec / 1e6 << "s on " << nthreads << " thread(s); "
+	      << changed_rays << " came out different\n";
+    if (ok)
+	std::cout << "Updated shots written to " << dinfo.json_ofile << "\n";
     else
-	bu_parallel(worker, nthreads, (void*)&targs);
+	std::cerr << "update of " << dinfo.update_file << " failed; " << dinfo.json_ofile << " is incomplete" << std::endl;
 
-    // write all collected data
-    tsj::Writer::Collector::flushToFile(dinfo.json_ofile);
-    
     /* cleanup */
-    destructor(base_inst);
-    bu_free(rays, "ray buffer");
+    for (int i = 1; i < nthreads; i++) {
+	if (!contexts[i])
+	    continue;
+	rt_clean_resource(contexts[i]->app.a_rt_i, contexts[i]->app.a_resource);
+	bu_free(contexts[i]->app.a_resource, "resource");
+    }
+    if (inst)
+	e.destructor(inst);
 }
 
-
 // Local Variables:
 // tab-width: 8
 // mode: C++
@@ -1,44 +1,488 @@
 #pragma once
 
 #include <string>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <fstream>
 #include <cstdio>
+#include <cstring>
+#include <charconv>
+#include <filesystem>
+#include <limits>
 
 #include <brlcad/bu.h>  // bu_semaphore
+#include <brlcad/raytrace.h>  // xray, partition
 
-static std::string
-d2s(double d)
-{
-    size_t prec = std::numeric_limits<double>::max_digits10;
-    std::ostringstream ss;
-    ss << std::fixed << std::setprecision(prec) << d;
-    std::string sd = ss.str();
-    return sd;
-}
+#include "comp/compare_config.h"
+#include "comp/shotbin.h"
+#include "comp/shotdigest.h"
+#include "comp/streamwriter.hpp"
 
 namespace tsj {
 
-/* Per-thread JSON writer; buffers shot data in-memory */
+/* Allocation-free formatting helpers for the writer hot path. Numbers are
+ * written as fixed with max_digits10 decimals - byte for byte what the old
+ * ostringstream based d2s() produced, so files from either version line up */
+namespace fmt {
+    // longest fixed double: 309 integer digits + sign + '.' + 17 decimals
+    constexpr size_t MAX_DOUBLE_CHARS = 330;
+
+    /* copy a string literal (without its terminator) to p */
+    template <size_t N>
+    inline char* lit(char* p, const char (&s)[N]) noexcept {
+        std::memcpy(p, s, N - 1);
+        return p + N - 1;
+    }
+
+    /* format d at p; p must have MAX_DOUBLE_CHARS of room */
+    inline char* num(char* p, double d) noexcept {
+        auto r = std::to_chars(p, p + MAX_DOUBLE_CHARS, d, std::chars_format::fixed, std::numeric_limits<double>::max_digits10);
+        return r.ptr;
+    }
+
+    /* "X":"..","Y":"..","Z":".." */
+    inline char* xyz(char* p, const double v[3]) noexcept {
+        p = lit(p, "{\"X\":\"");
+        p = num(p, v[0]);
+        p = lit(p, "\",\"Y\":\"");
+        p = num(p, v[1]);
+        p = lit(p, "\",\"Z\":\"");
+        p = num(p, v[2]);
+        return lit(p, "\"}");
+    }
+}
+
+/* Checkpoint log of an ordered diff run, written next to its output as
+ * <output>.ckpt.  A record is appended each time the output files have
+ * been synced to disk: the first `chunks` chunks are complete, and how long
+ * each file was at that point.  It also carries the result tree leaves and
+ * region names added since the record before, so a resumed run can rebuild
+ * both.  Resuming replays the records, cuts the files back to the last one
+ * and shoots the remaining chunks.  Records cut short by a crash fail
+ * their check and are dropped.  The log is removed once the run finishes.
+ *
+ *   Header
+ *   { Rec, ChunkNode[nnodes], region names (uint32 length, chars), padded to 8 }[]
+ */
+namespace checkpoint {
+    constexpr char FILE_MAGIC[8] = {'R', 'T', 'C', 'M', 'P', 'C', 'K', 'P'};
+    constexpr char REC_MAGIC[4] = {'C', 'K', 'P', 'T'};
+    constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t pad;
+        uint64_t run;                   // identity of the run (rays, format, ...) it may resume
+    };
+
+    struct Rec {
+        char magic[4];
+        uint32_t nregions;              // region names following the tree leaves
+        uint64_t chunks;                // chunks complete in every output file
+        uint64_t bytes;                 // length of the shots file (digest runs: detail file)
+        uint64_t digest_bytes;          // digest runs: length of the digest file
+        uint64_t nnodes;                // leaves of chunks [chunks - nnodes, chunks)
+        uint64_t payload;               // bytes following this record
+        uint64_t check;                 // hash of the payload
+    };
+
+    static_assert(sizeof(Header) == 24, "checkpoint header layout");
+    static_assert(sizeof(Rec) == 56, "checkpoint record layout");
+
+    inline std::string path(const std::string &results) { return results + ".ckpt"; }
+
+    inline uint64_t hash(const std::string &payload) noexcept {
+        uint64_t h = 0x9e3779b97f4a7c15ULL;
+        for (size_t i = 0; i + sizeof(uint64_t) <= payload.size(); i += sizeof(uint64_t)) {
+            uint64_t w;
+            std::memcpy(&w, payload.data() + i, sizeof(w));
+            h = shotdigest::combine(h, w);
+        }
+        return h;
+    }
+
+    /* what a log says about the run it was written for */
+    struct State {
+        uint64_t chunks = 0;
+        uint64_t bytes = 0;
+        uint64_t digest_bytes = 0;
+        uint64_t log_bytes = 0;         // end of the last good record
+        std::vector<shotdigest::ChunkNode> nodes;
+        std::vector<std::string> regions;
+    };
+
+    /* replay the log at path; false if it cannot be read or was written
+     * by a different run than run */
+    inline bool load(const std::string &path, uint64_t run, State &s) {
+        std::ifstream in(path, std::ios::binary);
+        Header h;
+        if (!in.read((char *)&h, sizeof(h)) || std::memcmp(h.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || h.version != VERSION) {
+            std::cerr << "not a checkpoint log: " << path << std::endl;
+            return false;
+        }
+        if (h.run != run) {
+            std::cerr << "checkpoint " << path << " is from a different run (other rays, geometry or output format)" << std::endl;
+            return false;
+        }
+        s = State();
+        s.log_bytes = sizeof(h);
+
+        Rec r;
+        std::string payload;
+        while (in.read((char *)&r, sizeof(r)) && std::memcmp(r.magic, REC_MAGIC, sizeof(REC_MAGIC)) == 0) {
+            payload.resize(r.payload);
+            if (r.nnodes * sizeof(shotdigest::ChunkNode) > r.payload || !in.read(&payload[0], payload.size()) || hash(payload) != r.check)
+                break;
+            const char *p = payload.data();
+            const char *end = p + payload.size();
+            for (uint64_t i = 0; i < r.nnodes; i++, p += sizeof(shotdigest::ChunkNode)) {
+                s.nodes.emplace_back();
+                std::memcpy(&s.nodes.back(), p, sizeof(shotdigest::ChunkNode));
+            }
+            for (uint32_t i = 0; i < r.nregions && p + sizeof(uint32_t) <= end; i++) {
+                uint32_t len;
+                std::memcpy(&len, p, sizeof(len));
+                p += sizeof(len);
+                s.regions.emplace_back(p, std::min<size_t>(len, end - p));
+                p += len;
+            }
+            s.chunks = r.chunks;
+            s.bytes = r.bytes;
+            s.digest_bytes = r.digest_bytes;
+            s.log_bytes += sizeof(r) + r.payload;
+        }
+        if (s.nodes.size() != s.chunks) {
+            std::cerr << "checkpoint " << path << " does not account for every chunk" << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+/* Per-thread JSON writer; fills pooled blocks that a background thread
+ * streams to disk as they fill up.  In binary mode shots are gathered in
+ * columns instead and each block carries one shotbin segment.  In digest
+ * mode each shot is reduced to a shotdigest record, and the full shots
+ * only go to the detail file (if any) */
 class Writer {
 public:
-    /* Global collector for thread buffers */
+    /* Global sink for thread blocks */
     struct Collector {
-        /* Internal storage for all thread-local buffers */
-        static std::vector<std::string>& buffers() {
-            static std::vector<std::string> instance;
+        static StreamWriter& sink() {
+            static StreamWriter instance;
             return instance;
         }
 
-        /* flush all collected buffers to disk (ONLY CALL ONCE after parallel run) */
-        static void flushToFile(const std::string &path) {
-            bu_semaphore_acquire(BU_SEM_SYSCALL);
-            std::ofstream out(path, std::ios::binary | std::ios::trunc);
-            for (auto &b : buffers()) {
-                out.write(b.data(), b.size());
+        /* digest mode: per-ray digests (sink() then holds the detail file) */
+        static StreamWriter& digestSink() {
+            static StreamWriter instance;
+            return instance;
+        }
+
+        /* output format switches, fixed for the length of a run */
+        struct Format {
+            bool binary = false;        // shotbin segments rather than NDJSON
+            bool compact = false;       // leave hit points out; readers rebuild them
+            bool compress = false;      // binary: XOR-delta encoded segments
+            bool region_ids = false;    // NDJSON: region ids + trailing region table
+            bool digest = false;        // per-ray digests to digestSink()
+            bool shots = true;          // full shots to sink() (digest mode: detail file)
+            bool tree = false;          // ordered: hash chunks of shot digests into a result tree
+            double digest_tol = 0;      // digest quantization step
+        };
+
+        static Format &format() {
+            static Format f;
+            return f;
+        }
+
+        /* Regions interned for region_ids output.  Threads cache the ids
+         * they have seen, so this is only locked the first time a thread
+         * meets a region */
+        struct RegionTable {
+            std::mutex mtx;
+            std::unordered_map<std::string, uint32_t> ids;
+            std::vector<std::string> names;
+
+            uint32_t intern(const char *name) {
+                std::lock_guard<std::mutex> lock(mtx);
+                auto it = ids.find(name);
+                if (it != ids.end())
+                    return it->second;
+                uint32_t id = (uint32_t)names.size();
+                names.emplace_back(name);
+                ids.emplace(names.back(), id);
+                return id;
+            }
+
+            /* {"region_table":["name0","name1",..]} */
+            std::string line() {
+                std::lock_guard<std::mutex> lock(mtx);
+                std::string s = "{\"region_table\":[";
+                for (size_t i = 0; i < names.size(); i++) {
+                    s.append((i) ? ",\"" : "\"");
+                    s.append(names[i]);
+                    s.append("\"");
+                }
+                s.append("]}\n");
+                return s;
+            }
+        };
+
+        static RegionTable &regions() {
+            static RegionTable t;
+            return t;
+        }
+
+        /* ordered runs: result tree leaves, by chunk */
+        struct TreeChunks {
+            std::mutex mtx;
+            std::vector<shotdigest::ChunkNode> chunks;
+
+            void set(uint64_t seq, const shotdigest::ChunkNode &c) {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (chunks.size() <= seq)
+                    chunks.resize(seq + 1);
+                chunks[seq] = c;
+            }
+        };
+
+        static TreeChunks &tree() {
+            static TreeChunks t;
+            return t;
+        }
+
+        /* ordered runs: the checkpoint log being appended to */
+        struct Checkpoints {
+            std::mutex mtx;
+            std::ofstream log;
+            std::string path;
+            uint64_t chunks = 0;        // chunks covered by the last record
+            size_t nregions = 0;        // region names logged so far
+        };
+
+        static Checkpoints &checkpoints() {
+            static Checkpoints c;
+            return c;
+        }
+
+        /* chunks a resumed run found complete; threads start after them */
+        static uint64_t &resumedChunks() {
+            static uint64_t n = 0;
+            return n;
+        }
+
+        /* start streaming to cfg.json_ofile in the format cfg asks for -
+         * call before the parallel run.  Digest runs write digests there
+         * and the shots themselves to cfg.digest_detail_file, if given.
+         * Ordered runs keep a checkpoint log for run (see checkpoint::) and
+         * with cfg.resume pick up where it left off */
+        static bool open(const CompareConfig &cfg, size_t nthreads, uint64_t run = 0) {
+            Format &f = format();
+            f.binary = cfg.binary;
+            f.compact = cfg.compact;
+            f.compress = cfg.binary && cfg.compress;
+            f.region_ids = cfg.region_ids && !cfg.binary;  // binary segments carry their own tables
+            f.digest = cfg.digest;
+            f.shots = !cfg.digest || !cfg.digest_detail_file.empty();
+            f.tree = cfg.ordered && !cfg.stream;  // nowhere to point into a pipe
+            f.digest_tol = cfg.tol;
+            tree().chunks.clear();
+            results() = cfg.json_ofile;
+            {
+                std::lock_guard<std::mutex> lock(regions().mtx);
+                regions().ids.clear();
+                regions().names.clear();
+            }
+            epoch()++;
+
+            // a resumed run starts from its last checkpoint
+            checkpoint::State state;
+            bool resume = false;
+            std::string log = checkpoint::path(cfg.json_ofile);
+            resumedChunks() = 0;
+            if (cfg.resume && cfg.ordered) {
+                if (!std::filesystem::exists(log)) {
+                    std::cerr << "no checkpoint " << log << ", starting from the beginning" << std::endl;
+                } else {
+                    if (!checkpoint::load(log, run, state))
+                        return false;
+                    resume = (state.chunks > 0);
+                    tree().chunks = state.nodes;
+                    for (const std::string &name : state.regions)
+                        regions().intern(name.c_str());
+                    resumedChunks() = state.chunks;
+                }
+            }
+            if (!p_openLog(cfg, log, run, (resume) ? &state : NULL))
+                return false;
+
+            // a fresh file starts with header, a resumed one keeps what it had
+            auto start = [&](StreamWriter &s, const std::string &path, size_t max_memory, const std::string &header, uint64_t bytes) {
+                s.setSync((checkpoints().log.is_open()) ? cfg.checkpoint_seconds : 0, &Collector::p_checkpoint);
+                if (resume)
+                    return s.resume(path, max_memory, nthreads, bytes, state.chunks);
+                return s.open(path, max_memory, nthreads, cfg.ordered, header);
+            };
+
+            uint32_t flags = ((f.compact) ? shotbin::FLAG_COMPACT : 0) | ((f.compress) ? shotbin::FLAG_COMPRESSED : 0);
+            std::string header = (f.binary) ? shotbin::fileHeader(flags) : std::string();
+            if (!f.digest)
+                return start(sink(), cfg.json_ofile, cfg.max_memory, header, state.bytes);
+
+            // the memory ceiling is shared between the two files
+            size_t max_memory = (f.shots) ? cfg.max_memory / 2 : cfg.max_memory;
+            std::string dheader = shotdigest::fileHeader(f.digest_tol, cfg.digest_detail_file);
+            if (!start(digestSink(), cfg.json_ofile, max_memory, dheader, state.digest_bytes))
+                return false;
+            if (f.shots && !start(sink(), cfg.digest_detail_file, max_memory, header, state.bytes)) {
+                digestSink().close();
+                return false;
             }
-            out.close();
-            bu_semaphore_release(BU_SEM_SYSCALL);
+            return true;
+        }
+
+        /* write out everything submitted and close (ONLY CALL ONCE after parallel run) */
+        static void close() {
+            sink().close((format().region_ids) ? regions().line() : std::string());
+            digestSink().close();
+
+            // the run is complete - nothing left to resume
+            {
+                Checkpoints &ck = checkpoints();
+                std::lock_guard<std::mutex> lock(ck.mtx);
+                if (ck.log.is_open()) {
+                    ck.log.close();
+                    std::error_code ec;
+                    std::filesystem::remove(ck.path, ec);
+                }
+            }
+
+            // the tree points into the file the run was asked for; a resumed
+            // run's earlier chunks already know where they are
+            if (format().tree) {
+                StreamWriter &s = (format().digest) ? digestSink() : sink();
+                std::vector<shotdigest::ChunkNode> &chunks = tree().chunks;
+                const std::vector<uint64_t> &offsets = s.chunkOffsets();
+                size_t first = resumedChunks();
+                if (chunks.size() < first || offsets.size() != chunks.size() - first + 1) {
+                    std::cerr << "ordered output: chunk offsets do not match, no result tree written\n";
+                    return;
+                }
+                for (size_t c = first; c < chunks.size(); c++) {
+                    chunks[c].offset = offsets[c - first];
+                    chunks[c].bytes = offsets[c - first + 1] - offsets[c - first];
+                }
+                shotdigest::writeTree(results(), format().digest_tol, chunks);
+            }
+        }
+
+        /* output file of the current run */
+        static std::string &results() {
+            static std::string r;
+            return r;
+        }
+
+        /* bumped by open() so thread-local region caches from an earlier run are dropped */
+        static unsigned &epoch() {
+            static unsigned e = 0;
+            return e;
+        }
+
+    private:
+        /* start the checkpoint log of an ordered run (continuing the one
+         * state was read from, if resuming) */
+        static bool p_openLog(const CompareConfig &cfg, const std::string &path, uint64_t run, const checkpoint::State *state) {
+            Checkpoints &ck = checkpoints();
+            std::lock_guard<std::mutex> lock(ck.mtx);
+            if (ck.log.is_open())
+                ck.log.close();
+            ck.path = path;
+            ck.chunks = (state) ? state->chunks : 0;
+            ck.nregions = (state) ? state->regions.size() : 0;
+            if (!cfg.ordered || cfg.checkpoint_seconds <= 0)
+                return true;
+
+            if (state) {
+                // drop a record cut short by the crash
+                std::error_code ec;
+                std::filesystem::resize_file(path, state->log_bytes, ec);
+                ck.log.open(path, std::ios::binary | std::ios::app);
+            } else {
+                ck.log.open(path, std::ios::binary | std::ios::trunc);
+                checkpoint::Header h;
+                std::memset(&h, 0, sizeof(h));
+                std::memcpy(h.magic, checkpoint::FILE_MAGIC, sizeof(h.magic));
+                h.version = checkpoint::VERSION;
+                h.run = run;
+                ck.log.write((const char *)&h, sizeof(h));
+                ck.log.flush();
+            }
+            if (!ck.log.is_open() || !ck.log.good()) {
+                std::cerr << "failed to open checkpoint log: " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        /* called by the writer threads after syncing: log the chunks that
+         * are now on disk in every output file */
+        static void p_checkpoint() {
+            const Format &f = format();
+            Checkpoints &ck = checkpoints();
+            std::lock_guard<std::mutex> lock(ck.mtx);
+            if (!ck.log.is_open())
+                return;
+            uint64_t n = (f.digest) ? digestSink().syncedChunks() : sink().syncedChunks();
+            if (f.digest && f.shots)
+                n = std::min(n, sink().syncedChunks());
+            if (n <= ck.chunks)
+                return;
+
+            checkpoint::Rec r;
+            std::memset(&r, 0, sizeof(r));
+            std::memcpy(r.magic, checkpoint::REC_MAGIC, sizeof(r.magic));
+            r.chunks = n;
+            r.bytes = (f.shots) ? sink().chunkStart(n) : 0;
+            r.digest_bytes = (f.digest) ? digestSink().chunkStart(n) : 0;
+            r.nnodes = n - ck.chunks;
+
+            // tree leaves, placed in the file the tree points into
+            std::string payload;
+            StreamWriter &s = (f.digest) ? digestSink() : sink();
+            {
+                std::lock_guard<std::mutex> tlock(tree().mtx);
+                for (uint64_t c = ck.chunks; c < n; c++) {
+                    shotdigest::ChunkNode node;
+                    std::memset(&node, 0, sizeof(node));
+                    if (c < tree().chunks.size())
+                        node = tree().chunks[c];
+                    node.offset = s.chunkStart(c);
+                    node.bytes = s.chunkStart(c + 1) - node.offset;
+                    payload.append((const char *)&node, sizeof(node));
+                }
+            }
+            {
+                std::lock_guard<std::mutex> rlock(regions().mtx);
+                for (size_t i = ck.nregions; i < regions().names.size(); i++) {
+                    uint32_t len = (uint32_t)regions().names[i].size();
+                    payload.append((const char *)&len, sizeof(len));
+                    payload.append(regions().names[i]);
+                }
+                r.nregions = (uint32_t)(regions().names.size() - ck.nregions);
+                ck.nregions = regions().names.size();
+            }
+            payload.append(shotbin::pad8(payload.size()) - payload.size(), '\0');
+            r.payload = payload.size();
+            r.check = checkpoint::hash(payload);
+
+            ck.log.write((const char *)&r, sizeof(r));
+            ck.log.write(payload.data(), payload.size());
+            ck.log.flush();
+            syncFile(ck.path);
+            ck.chunks = n;
         }
     };
 
@@ -50,18 +494,60 @@ public:
         return w;
     }
 
-    /* Reserve an initial buffer capacity (bytes) */
-    void reserve(size_t bytes) {
-        buf.reserve(bytes);
-    }
-
     /* Begin a new shot: open partition array, stash ray origin/dir for later
      * TODO: json.hpp .dump() writes partitions first and then ray info
      *       which is the pattern we're copying. Need to see if we can just
      *       write ray info first so we don't have to stash
      */
     inline void beginShot(const struct xray &ray) {
-        buf.append("{\"partitions\":[");
+        if (capture) {
+            VMOVE(capture->ray.pt, ray.r_pt);
+            VMOVE(capture->ray.dir, ray.r_dir);
+            capture->parts.clear();
+            capture->idx = next_idx;
+            capture->view = next_view;
+            next_idx = -1;
+            return;
+        }
+        const Collector::Format &f = Collector::format();
+        if (f.digest || f.tree) {
+            digest_key = next_idx;
+            digest.begin(ray.r_pt, ray.r_dir, f.digest_tol);
+            if (f.tree && !chunk_node.nrays) {
+                chunk_node.first_ray = (uint64_t)next_idx;
+                chunk_node.view = next_view;
+            }
+        }
+        if (!f.shots) {
+            next_idx = -1;
+            return;
+        }
+
+        if (f.binary) {
+            seg.setCompact(f.compact);
+            seg.setCompressed(f.compress);
+            seg.beginShot(ray.r_pt, ray.r_dir, next_idx, (next_idx >= 0) ? next_view : -1);
+            next_idx = -1;
+            return;
+        }
+
+        if (!block)
+            p_takeBlock(Collector::sink(), block);
+
+        // lead with the ray's identity so readers can key on it cheaply
+        if (next_idx >= 0) {
+            char tmp[64];
+            char *p = tmp;
+            p = fmt::lit(p, "{\"ray_idx\":");
+            p = std::to_chars(p, tmp + sizeof(tmp), next_idx).ptr;
+            p = fmt::lit(p, ",\"view\":");
+            p = std::to_chars(p, tmp + sizeof(tmp), next_view).ptr;
+            p = fmt::lit(p, ",\"partitions\":[");
+            block->data.append(tmp, p - tmp);
+            next_idx = -1;
+        } else {
+            block->data.append("{\"partitions\":[");
+        }
 
         // stash the ray for endShot()
         ray_pt[0]  = ray.r_pt[0];
@@ -72,64 +558,242 @@ public:
         ray_dir[2] = ray.r_dir[2];
     }
 
+    /* in-process differential runs: until endCapture() shots are recorded
+     * into shot instead of being written out */
+    inline void beginCapture(Shot *shot) { capture = shot; }
+    inline void endCapture() { capture = NULL; }
+
+    /* tag the next shot with its ray pool index and view (-1: no view) */
+    inline void setRayId(int64_t idx, int view) {
+        next_idx = idx;
+        next_view = view;
+    }
+
     /* append a partition */
     inline void addPartition(struct partition* pp) {
-        char tmp[1024];
-        int n = std::snprintf(tmp, sizeof(tmp),
-            "{\"in_dist\":\"%s\","
-            "\"in_norm\":{\"X\":\"%s\",\"Y\":\"%s\",\"Z\":\"%s\"},"
-            "\"in_pt\":{\"X\":\"%s\",\"Y\":\"%s\",\"Z\":\"%s\"},"
-            "\"out_dist\":\"%s\","
-            "\"out_norm\":{\"X\":\"%s\",\"Y\":\"%s\",\"Z\":\"%s\"},"
-            "\"out_pt\":{\"X\":\"%s\",\"Y\":\"%s\",\"Z\":\"%s\"},"
-            "\"region\":\"%s\"},",
-            d2s(pp->pt_inhit->hit_dist).c_str(), //in_dist,
-            d2s(pp->pt_inhit->hit_normal[X]).c_str(), d2s(pp->pt_inhit->hit_normal[Y]).c_str(), d2s(pp->pt_inhit->hit_normal[Z]).c_str(), //in_norm[0], in_norm[1], in_norm[2],
-            d2s(pp->pt_inhit->hit_point[X]).c_str(), d2s(pp->pt_inhit->hit_point[Y]).c_str(), d2s(pp->pt_inhit->hit_point[Z]).c_str(), //in_pt[0],    in_pt[1],    in_pt[2],
-            d2s(pp->pt_outhit->hit_dist).c_str(), //out_dist,
-            d2s(pp->pt_outhit->hit_normal[X]).c_str(), d2s(pp->pt_outhit->hit_normal[Y]).c_str(), d2s(pp->pt_outhit->hit_normal[Z]).c_str(), //out_norm[0], out_norm[1], out_norm[2],
-            d2s(pp->pt_outhit->hit_point[X]).c_str(), d2s(pp->pt_outhit->hit_point[Y]).c_str(), d2s(pp->pt_outhit->hit_point[Z]).c_str(), //out_pt[0],   out_pt[1],   out_pt[2],
-            pp->pt_regionp->reg_name //region
-        );
-        buf.append(tmp, n);
+        if (capture) {
+            capture->parts.emplace_back(0.0);
+            Shot::Partition &part = capture->parts.back();
+            part.region = pp->pt_regionp->reg_name;
+            VMOVE(part.in, pp->pt_inhit->hit_point);
+            VMOVE(part.in_norm, pp->pt_inhit->hit_normal);
+            part.in_dist = pp->pt_inhit->hit_dist;
+            VMOVE(part.out, pp->pt_outhit->hit_point);
+            VMOVE(part.out_norm, pp->pt_outhit->hit_normal);
+            part.out_dist = pp->pt_outhit->hit_dist;
+            return;
+        }
+        const Collector::Format &f = Collector::format();
+        if (f.digest || f.tree) {
+            digest.partition(pp->pt_inhit->hit_dist, pp->pt_inhit->hit_normal,
+                             pp->pt_outhit->hit_dist, pp->pt_outhit->hit_normal,
+                             pp->pt_regionp->reg_name);
+        }
+        if (!f.shots)
+            return;
+
+        if (f.binary) {
+            seg.addPartition(pp->pt_inhit->hit_dist, pp->pt_inhit->hit_point, pp->pt_inhit->hit_normal,
+                             pp->pt_outhit->hit_dist, pp->pt_outhit->hit_point, pp->pt_outhit->hit_normal,
+                             pp->pt_regionp->reg_name);
+            return;
+        }
+
+        // 19 numbers + keys; region name is appended separately since its length is unbounded
+        char tmp[19 * fmt::MAX_DOUBLE_CHARS + 256];
+        char *p = tmp;
+        bool compact = f.compact;
+        p = fmt::lit(p, "{\"in_dist\":\"");
+        p = fmt::num(p, pp->pt_inhit->hit_dist);
+        p = fmt::lit(p, "\",\"in_norm\":");
+        p = fmt::xyz(p, pp->pt_inhit->hit_normal);
+        if (!compact) {
+            p = fmt::lit(p, ",\"in_pt\":");
+            p = fmt::xyz(p, pp->pt_inhit->hit_point);
+        }
+        p = fmt::lit(p, ",\"out_dist\":\"");
+        p = fmt::num(p, pp->pt_outhit->hit_dist);
+        p = fmt::lit(p, "\",\"out_norm\":");
+        p = fmt::xyz(p, pp->pt_outhit->hit_normal);
+        if (!compact) {
+            p = fmt::lit(p, ",\"out_pt\":");
+            p = fmt::xyz(p, pp->pt_outhit->hit_point);
+        }
+        std::string &buf = block->data;
+        if (f.region_ids) {
+            p = fmt::lit(p, ",\"region_id\":");
+            p = std::to_chars(p, tmp + sizeof(tmp), p_regionId(pp->pt_regionp)).ptr;
+            p = fmt::lit(p, "},");
+            buf.append(tmp, p - tmp);
+            return;
+        }
+        p = fmt::lit(p, ",\"region\":\"");
+        buf.append(tmp, p - tmp);
+        buf.append(pp->pt_regionp->reg_name);
+        buf.append("\"},");
     }
 
     /* End the shot: close partitions array, append ray fields,
      *               then hand off buffer to global collector */
     inline void endShot() {
+        if (capture)
+            return;
+        const Collector::Format &f = Collector::format();
+        if (f.tree) {
+            chunk_node.hash = shotdigest::combine(chunk_node.hash, digest.value());
+            chunk_node.nrays++;
+        }
+        if (f.digest) {
+            p_putDigest();
+            if (!f.shots)
+                return;
+        }
+
+        if (f.binary) {
+            if (seg.bytes() + HANDOFF_SLACK >= Collector::sink().blockBytes())
+                syncToGlobal();
+            return;
+        }
+
+        std::string &buf = block->data;
+
         // replace trailing comma with closing bracket
         if (!buf.empty() && buf.back() == ',') 
             buf.back() = ']';
         else 
             buf.append("]");
 
-        char tmp[512];
-        int n = std::snprintf(tmp, sizeof(tmp),
-            ",\"ray_dir\":{\"X\":\"%s\",\"Y\":\"%s\",\"Z\":\"%s\"},"
-            "\"ray_pt\":{\"X\":\"%s\",\"Y\":\"%s\",\"Z\":\"%s\"}}\n",
-            d2s(ray_dir[0]).c_str(), d2s(ray_dir[1]).c_str(), d2s(ray_dir[2]).c_str(),
-            d2s(ray_pt[0]).c_str(),  d2s(ray_pt[1]).c_str(),  d2s(ray_pt[2]).c_str()
-        );
-        buf.append(tmp, n);
-
-        // hand off to global if we're getting close to our max size
-        if (buf.capacity() - buf.size() < 2048) {   // check if we've almost maxed out our str
+        char tmp[6 * fmt::MAX_DOUBLE_CHARS + 128];
+        char *p = tmp;
+        p = fmt::lit(p, ",\"ray_dir\":");
+        p = fmt::xyz(p, ray_dir);
+        p = fmt::lit(p, ",\"ray_pt\":");
+        p = fmt::xyz(p, ray_pt);
+        p = fmt::lit(p, "}\n");
+        buf.append(tmp, p - tmp);
+
+        // hand off to the writer thread once the block is close to full
+        if (buf.size() + HANDOFF_SLACK >= Collector::sink().blockBytes()) {
             syncToGlobal();
         }
     }
 
+    /* hand the current block to the writer thread; the next shot picks up a fresh one */
     inline void syncToGlobal() {
-        bu_semaphore_acquire(BU_SEM_SYSCALL);
-        Collector::buffers().push_back(std::move(buf));
-        bu_semaphore_release(BU_SEM_SYSCALL);
+        if (!seg.empty())
+            p_flushSegment();
+        if (dblock) {
+            Collector::digestSink().submit(dblock);
+            dblock = NULL;
+        }
+        if (!block)
+            return;
+        Collector::sink().submit(block);
+        block = NULL;
+    }
 
-        buf.clear();
+    /* ordered output: shots until endChunk() belong to chunk seq */
+    inline void beginChunk(uint64_t seq) {
+        syncToGlobal();
+        chunk = true;
+        chunk_seq = seq;
+        chunk_part = 0;
+        dchunk_part = 0;
+        std::memset(&chunk_node, 0, sizeof(chunk_node));
+        chunk_node.hash = 0x9e3779b97f4a7c15ULL;
+        chunk_node.view = -1;
+    }
+
+    /* close the chunk - its last block is submitted even if empty so the
+     * writer knows to move on */
+    inline void endChunk() {
+        const Collector::Format &f = Collector::format();
+        if (!seg.empty())
+            p_flushSegment();
+        if (f.digest) {
+            if (!dblock)
+                p_takeBlock(Collector::digestSink(), dblock);
+            dblock->last = true;
+        }
+        if (f.shots) {
+            if (!block)
+                p_takeBlock(Collector::sink(), block);
+            block->last = true;
+        }
+        if (f.tree)
+            Collector::tree().set(chunk_seq, chunk_node);
+        syncToGlobal();
+        chunk = false;
     }
 private:
     Writer() = default;
     ~Writer() = default;
 
-    std::string buf;
+    /* region_ids mode: global id for a region, cached per thread by
+     * region pointer (all threads share the run's rt_i) */
+    inline uint32_t p_regionId(const struct region *rp) {
+        if (region_epoch != Collector::epoch()) {
+            region_cache.clear();
+            region_epoch = Collector::epoch();
+        }
+        auto it = region_cache.find(rp);
+        if (it != region_cache.end())
+            return it->second;
+        uint32_t id = Collector::regions().intern(rp->reg_name);
+        region_cache.emplace(rp, id);
+        return id;
+    }
+
+    /* binary mode: write the gathered columns out as one segment */
+    inline void p_flushSegment() {
+        if (!block)
+            p_takeBlock(Collector::sink(), block);
+        seg.serialize(block->data);
+    }
+
+    /* digest mode: record the finished shot's digest */
+    inline void p_putDigest() {
+        if (!dblock)
+            p_takeBlock(Collector::digestSink(), dblock);
+        shotdigest::Rec r;
+        r.key = (uint64_t)digest_key;
+        r.digest = digest.value();
+        dblock->data.append((const char*)&r, sizeof(r));
+        if (dblock->data.size() + sizeof(r) > Collector::digestSink().blockBytes()) {
+            Collector::digestSink().submit(dblock);
+            dblock = NULL;
+        }
+    }
+
+    inline void p_takeBlock(StreamWriter &s, Block *&b) {
+        if (!chunk) {
+            b = s.acquire();
+            return;
+        }
+        b = s.acquire(chunk_seq);
+        b->seq = chunk_seq;
+        b->part = (&b == &dblock) ? dchunk_part++ : chunk_part++;
+        b->last = false;
+    }
+
+    // room left in a block for one more shot before it is handed off
+    static constexpr size_t HANDOFF_SLACK = 8192;
+
+    Block *block = NULL;
+    Block *dblock = NULL;               // digest mode: digest records
+    Shot *capture = NULL;               // beginCapture(): shot being recorded
+    shotbin::SegmentBuilder seg;
+    shotdigest::Digest digest;
+    int64_t digest_key = -1;
+    shotdigest::ChunkNode chunk_node{}; // ordered mode: result tree leaf of the current chunk
+    std::unordered_map<const struct region*, uint32_t> region_cache;
+    unsigned region_epoch = 0;
+    bool chunk = false;
+    uint64_t chunk_seq = 0;
+    uint32_t chunk_part = 0;
+    uint32_t dchunk_part = 0;
+    int64_t next_idx = -1;
+    int next_view = -1;
     double ray_pt[3];
     double ray_dir[3];
 
@@ -1,7 +1,11 @@
 #include "shot_comp.h"
 
+#include <algorithm>
+#include <atomic>
 #include <thread>
 #include <charconv>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include <sstream>
 #include <brlcad/bu.h>
@@ -10,7 +14,24 @@
 /***************************/
 /***** ShotIndex class *****/
 /***************************/
-ShotIndex::ShotIndex(const std::string& filename): p_filename(filename) {
+
+/* Compressed segments decoded for lookups, per thread.  A compare reads
+ * two files, each mostly in file order, so a few segments cover it */
+struct SegmentCache {
+    struct Slot {
+	uint64_t owner = 0;                 // ShotIndex serial (0: empty)
+	size_t seg = 0;
+	uint64_t used = 0;
+	std::string data;
+	shotbin::SegmentView view;
+    };
+    Slot slots[4];
+    uint64_t tick = 0;
+};
+static thread_local SegmentCache t_segment_cache;
+static std::atomic<uint64_t> s_next_serial{1};
+
+ShotIndex::ShotIndex(const std::string& filename): p_filename(filename), p_serial(s_next_serial++) {
     // TODO: check filename exists
 
     // open ifstream; mark valid
@@ -22,13 +43,68 @@ ShotIndex::ShotIndex(const std::string& filename): p_filename(filename) {
         return;
     }
 
+    // binary shot files are mapped and read in place
+    if (shotbin::isBinaryFile(p_filename)) {
+	p_file.close();
+	p_map = bu_open_mapped_file(p_filename.c_str(), NULL);
+	if (!p_map) {
+	    std::cerr << "ERROR mapping " << filename << "\n";
+	    p_valid = false;
+	    return;
+	}
+	p_binary = true;
+
+	// compressed segments stay compressed in the map - they are decoded
+	// while indexing and again as lookups reach them
+	const char* buf = (const char*)p_map->buf;
+	std::vector<std::string> none;
+	p_compressed = (shotbin::fileFlags(buf) & shotbin::FLAG_COMPRESSED);
+	bool ok = (p_compressed) ? shotbin::findSegments(buf, p_map->buflen, p_seg_starts, p_seg_offsets)
+				 : shotbin::loadSegments(buf, p_map->buflen, p_segs, p_seg_offsets, none, 1);
+	const shotbin::SegmentView* first = (ok && !p_seg_offsets.empty()) ? p_segment(0) : NULL;
+	if (!ok || (!p_seg_offsets.empty() && !first)) {
+	    std::cerr << "ERROR reading " << filename << "\n";
+	    p_valid = false;
+	    return;
+	}
+
+	// key on ray index if the first shot has one - densely, unless the
+	// indices spread much wider than the shots the segments hold
+	if (first && first->size())
+	    p_by_index = (first->rec(0).idx >= 0);
+	uint64_t nshots = 0;
+	for (size_t s = 0; s < p_seg_offsets.size(); s++) {
+	    shotbin::SegHeader h;
+	    std::memcpy(&h, buf + ((p_compressed) ? p_seg_starts[s] : p_seg_offsets[s]), sizeof(h));
+	    nshots += h.nshots;
+	}
+	p_max_span = INDEX_SPAN_PER_SHOT * nshots + MIN_INDEX_SPAN;
+	if (!p_by_index)
+	    p_offset_map.reserve(p_map->buflen / 128);
+	p_buildIndex();
+	return;
+    }
+
+    // region table, if the shots were written with region ids
+    shot_utils::read_region_table(p_filename, p_regions);
+
     // get a very rough guess on number of lines
     auto file_size = std::filesystem::file_size(p_filename);
     size_t avg_bytes_per_line = 650;	// arbitrary-ish value
     size_t estimated_lines = file_size / avg_bytes_per_line;
     // upfront ballpark reserve before indexing
     p_ordered_keys.reserve(estimated_lines);
-    p_offset_map.reserve(estimated_lines * 1.3);    // load factor ~0.75
+
+    // files from diff runs that record ray indices can skip ray hashing
+    std::string first;
+    int64_t idx;
+    int view;
+    while (std::getline(p_file, first) && first.empty())
+	;
+    p_by_index = shot_utils::parse_json_id(first, idx, view);
+    p_max_span = INDEX_SPAN_PER_SHOT * (file_size / MIN_SHOT_LINE_BYTES) + MIN_INDEX_SPAN;
+    if (!p_by_index)
+	p_offset_map.reserve(estimated_lines * 1.3);    // load factor ~0.75
     
     // index
     p_buildIndex();
@@ -37,21 +113,49 @@ ShotIndex::ShotIndex(const std::string& filename): p_filename(filename) {
 ShotIndex::~ShotIndex() {
     if (p_file.is_open())
 	p_file.close();
+    if (p_map)
+	bu_close_mapped_file(p_map);
+
+    // release what this thread decoded (other threads' slots get reused)
+    for (auto& slot : t_segment_cache.slots) {
+	if (slot.owner == p_serial) {
+	    slot.owner = 0;
+	    std::string().swap(slot.data);
+	}
+    }
 }
 
 // basic getters
 bool ShotIndex::isValid() const noexcept { return p_valid; }
+bool ShotIndex::keyedByRayIndex() const noexcept { return p_by_index; }
 const std::vector<std::pair<uint64_t,uint64_t>>& ShotIndex::orderedKeys() const noexcept { return p_ordered_keys; }
 std::string ShotIndex::filename() const noexcept { return p_filename; }
+const std::vector<std::string>& ShotIndex::regionTable() const noexcept { return p_regions; }
+
+void ShotIndex::rekeyByHash() {
+    if (!p_by_index)
+	return;
+    p_by_index = false;
+    p_buildIndex();
+}
 
 void ShotIndex::p_buildIndex() {
     if (!p_valid)
 	return;
 
     // zero
+    p_file.clear();
     p_file.seekg(0, std::ios::beg);
     p_ordered_keys.clear();
     p_offset_map.clear();
+    p_index_offsets.clear();
+    p_index_base = 0;
+    p_dense = true;
+
+    if (p_binary) {
+	p_buildBinaryIndex();
+	return;
+    }
 
     std::string line;
     uint64_t offset = 0;
@@ -60,13 +164,27 @@ void ShotIndex::p_buildIndex() {
 	if (!std::getline(p_file, line)) 
 	    break;
 	
-	// skip empty lines
-	if (line.empty()) 
+	// skip empty lines and the region table
+	if (line.empty() || shot_utils::is_region_table(line))
 	    continue;
 
 	try {
-	    Shot::Ray ray = shot_utils::parse_json_ray(line);
-	    uint64_t key = shot_utils::hash_ray(ray);
+	    uint64_t key;
+	    if (p_by_index) {
+		int64_t idx;
+		int view;
+		if (!shot_utils::parse_json_id(line, idx, view) || idx < 0) {
+		    // mixed file - every shot has to use the same key
+		    std::cerr << "shot without ray index at offset " << offset << ", indexing " << p_filename << " by ray hash" << std::endl;
+		    p_by_index = false;
+		    p_buildIndex();
+		    return;
+		}
+		key = (uint64_t)idx;
+	    } else {
+		Shot::Ray ray = shot_utils::parse_json_ray(line);
+		key = shot_utils::hash_ray(ray);
+	    }
 
 	    // collision check
 	    auto collision_check = lookup(key);
@@ -91,8 +209,7 @@ void ShotIndex::p_buildIndex() {
                 continue;
 	    }
 	    // add
-	    p_offset_map[key] = offset;
-	    p_ordered_keys.emplace_back(offset, key);
+	    p_addKey(key, offset);
 	} catch (const std::exception& e) {
 	    std::cerr << "ShotIndex file parse error at offset " << offset << ": " << e.what() << std::endl;
             // lazy - keep going if we can
@@ -101,29 +218,180 @@ void ShotIndex::p_buildIndex() {
     }
 
     // sanity
-    if (p_offset_map.size() != p_ordered_keys.size()) {
+    if ((!p_by_index || !p_dense) && p_offset_map.size() != p_ordered_keys.size()) {
 	std::cerr << "indexing alignment error" << std::endl;
         p_valid = false;
     }
 
-    std::cout << "  DEBUG: indexed " << p_offset_map.size() << " shots in " << p_filename << "\n";
+    std::cout << "  DEBUG: indexed " << p_ordered_keys.size() << " shots in " << p_filename << (p_by_index ? " by ray index" : "") << "\n";
+}
+
+void ShotIndex::p_addKey(uint64_t key, uint64_t offset) {
+    if (p_by_index && p_dense) {
+	// the table spans the indices seen, wherever they start - but never
+	// far more than the file can hold.  Sparse (or corrupt) indices are
+	// hashed instead
+	uint64_t lo = (p_index_offsets.empty()) ? key : std::min(key, p_index_base);
+	uint64_t hi = (p_index_offsets.empty()) ? key : std::max<uint64_t>(key, p_index_base + p_index_offsets.size() - 1);
+	if (hi - lo >= p_max_span) {
+	    for (size_t i = 0; i < p_index_offsets.size(); i++) {
+		if (p_index_offsets[i] != NO_OFFSET)
+		    p_offset_map[p_index_base + i] = p_index_offsets[i];
+	    }
+	    std::vector<uint64_t>().swap(p_index_offsets);
+	    p_index_base = 0;
+	    p_dense = false;
+	}
+    }
+
+    if (p_by_index && p_dense) {
+	if (p_index_offsets.empty())
+	    p_index_base = key;
+	if (key < p_index_base) {
+	    uint64_t grow = std::min<uint64_t>(std::max<uint64_t>(p_index_base - key, p_index_offsets.size()), p_index_base);
+	    grow = std::min<uint64_t>(grow, p_max_span - p_index_offsets.size());
+	    p_index_offsets.insert(p_index_offsets.begin(), grow, NO_OFFSET);
+	    p_index_base -= grow;
+	}
+	uint64_t slot = key - p_index_base;
+	if (slot >= p_index_offsets.size())
+	    p_index_offsets.resize(std::min<uint64_t>(std::max<uint64_t>(slot + 1, p_index_offsets.size() * 2), p_max_span), NO_OFFSET);
+	p_index_offsets[slot] = offset;
+    } else {
+	p_offset_map[key] = offset;
+    }
+    p_ordered_keys.emplace_back(offset, key);
+}
+
+const shotbin::SegmentView* ShotIndex::p_segment(size_t s) const {
+    if (!p_compressed)
+	return &p_segs[s];
+
+    SegmentCache& c = t_segment_cache;
+    SegmentCache::Slot* victim = &c.slots[0];
+    for (auto& slot : c.slots) {
+	if (slot.owner == p_serial && slot.seg == s) {
+	    slot.used = ++c.tick;
+	    return &slot.view;
+	}
+	if (slot.used < victim->used)
+	    victim = &slot;
+    }
+
+    // decode into the least recently used slot
+    const char* buf = (const char*)p_map->buf;
+    uint32_t flags = shotbin::fileFlags(buf);
+    victim->owner = 0;
+    if (!shotbin::decompressSegment(buf + p_seg_starts[s], p_map->buflen - p_seg_starts[s], flags, victim->data) ||
+	!victim->view.init(victim->data.data(), victim->data.size(), flags))
+	return NULL;
+    victim->owner = p_serial;
+    victim->seg = s;
+    victim->used = ++c.tick;
+    return &victim->view;
+}
+
+void ShotIndex::p_buildBinaryIndex() {
+    // compressed segments are decoded a batch at a time, in parallel
+    const char* buf = (const char*)p_map->buf;
+    uint32_t flags = shotbin::fileFlags(buf);
+    unsigned nthreads = bu_avail_cpus();
+    size_t nsegs = p_seg_offsets.size();
+    size_t batch = (p_compressed) ? 2 * (size_t)nthreads : std::max<size_t>(nsegs, 1);
+    std::vector<std::string> decoded;
+    std::vector<shotbin::SegmentView> views;
+
+    for (size_t first = 0; first < nsegs; first += batch) {
+	size_t count = std::min(batch, nsegs - first);
+	if (p_compressed) {
+	    if (!shotbin::decodeSegments(buf, p_map->buflen, p_seg_starts.data() + first, count, decoded, nthreads)) {
+		p_valid = false;
+		return;
+	    }
+	    views.resize(count);
+	    for (size_t k = 0; k < count; k++) {
+		if (!views[k].init(decoded[k].data(), decoded[k].size(), flags)) {
+		    std::cerr << "malformed shot segment at offset " << p_seg_starts[first + k] << std::endl;
+		    p_valid = false;
+		    return;
+		}
+	    }
+	}
+
+	for (size_t s = first; s < first + count; s++) {
+	    const shotbin::SegmentView& seg = (p_compressed) ? views[s - first] : p_segs[s];
+	    uint64_t off = p_seg_offsets[s];
+
+	    for (size_t i = 0; i < seg.size(); i++) {
+		const shotbin::ShotRec& r = seg.rec(i);
+		uint64_t rec_off = off + sizeof(shotbin::SegHeader) + i * sizeof(shotbin::ShotRec);
+		uint64_t key;
+		if (p_by_index) {
+		    if (r.idx < 0) {
+			std::cerr << "shot without ray index at offset " << rec_off << ", indexing " << p_filename << " by ray hash" << std::endl;
+			p_by_index = false;
+			p_buildIndex();
+			return;
+		    }
+		    key = (uint64_t)r.idx;
+		} else {
+		    Shot::Ray ray(0.0);
+		    VMOVE(ray.pt, r.pt);
+		    VMOVE(ray.dir, r.dir);
+		    key = shot_utils::hash_ray(ray);
+		}
+
+		// duplicate shots are skipped, differing ones with the same key are fatal
+		auto collision_check = lookup(key);
+		if (collision_check.has_value()) {
+		    Shot prev = getShot(key).value();
+		    Shot cur = seg.shot(i);
+		    if (!shot_utils::shot_identical(&prev, &cur)) {
+			std::cerr << "KEY COLLISION FOR " << key << " at offsets " << collision_check.value() << " and " << rec_off << ". Check file is valid" << std::endl;
+			p_valid = false;
+			return;
+		    }
+		    continue;
+		}
+		p_addKey(key, rec_off);
+	    }
+	}
+    }
+
+    std::cout << "  DEBUG: indexed " << p_ordered_keys.size() << " shots in " << p_filename << (p_by_index ? " by ray index" : "") << "\n";
 }
 
-std::optional<uint64_t> ShotIndex::lookup(uint64_t rayHash) const noexcept {
-    auto it = p_offset_map.find(rayHash);
+std::optional<uint64_t> ShotIndex::lookup(uint64_t key) const noexcept {
+    if (p_by_index && p_dense) {
+	if (key < p_index_base || key - p_index_base >= p_index_offsets.size() || p_index_offsets[key - p_index_base] == NO_OFFSET)
+	    return std::nullopt;
+	return p_index_offsets[key - p_index_base];
+    }
+
+    auto it = p_offset_map.find(key);
     if (it == p_offset_map.end()) 
 	return std::nullopt;
 
     return it->second;
 }
 
-std::optional<Shot> ShotIndex::getShot(uint64_t rayHash) const {
+std::optional<Shot> ShotIndex::getShot(uint64_t key) const {
     // find the offset
-    auto maybe_offset = lookup(rayHash);
+    auto maybe_offset = lookup(key);
     if (!maybe_offset) 
         return std::nullopt;
     uint64_t offset = *maybe_offset;
 
+    // binary: decode straight from the mapped file
+    if (p_binary) {
+	size_t s = std::upper_bound(p_seg_offsets.begin(), p_seg_offsets.end(), offset) - p_seg_offsets.begin() - 1;
+	size_t i = (offset - p_seg_offsets[s] - sizeof(shotbin::SegHeader)) / sizeof(shotbin::ShotRec);
+	const shotbin::SegmentView* seg = p_segment(s);
+	if (!seg)
+	    return std::nullopt;
+	return seg->shot(i);
+    }
+
     // open a short-lived ifstream so we don't clobber the main index file
     std::ifstream in(p_filename, std::ios::binary);
     if (!in.is_open()) 
@@ -152,7 +420,9 @@ std::optional<Shot> ShotIndex::getShot(uint64_t rayHash) const {
 ComparisonResult::ComparisonResult(const ShotIndex& idxA,
                                    const ShotIndex& idxB,
                                    double tolerance,
-                                   int nThreads) : p_idxA(&idxA), p_idxB(&idxB), p_tolerance(tolerance) {
+                                   int nThreads,
+                                   bool compareDerived) : p_idxA(&idxA), p_idxB(&idxB), p_tolerance(tolerance), p_compareDerived(compareDerived),
+                                                          p_regionMap(idxA.regionTable(), idxB.regionTable()) {
     // prepare threading parameters
     const auto& keysA = p_idxA->orderedKeys();
     size_t total_indices = keysA.size();
@@ -211,13 +481,18 @@ void ComparisonResult::p_compareOne(uint64_t rayHash) {
         // couldn't find in B
         std::lock_guard<std::mutex> lock(p_mtxResult);
         p_onlyA.emplace_back(rayHash);
+        if (shotA.view >= 0)
+            p_viewDiffs[shotA.view]++;
         return;
     }
     Shot shotB = std::move(*maybe_B);
+    p_regionMap.align(shotA, shotB);
 
-    if (!shot_utils::shot_equal_at_tol(&shotA, &shotB, p_tolerance)) {
+    if (!shot_utils::shot_equal_at_tol(&shotA, &shotB, p_tolerance, p_compareDerived)) {
         std::lock_guard<std::mutex> lock(p_mtxResult);
         p_differing.emplace_back(rayHash);
+        if (shotA.view >= 0)
+            p_viewDiffs[shotA.view]++;
     }
 }
 
@@ -245,6 +520,13 @@ void ComparisonResult::summary(const std::string& filename) const {
             this->writeOnlyB(filename);
         }
 
+        // per view breakdown, when the files recorded views
+        if (!p_viewDiffs.empty()) {
+            std::cout << "\tdifferences by view:\n";
+            for (auto const& [view, count] : p_viewDiffs)
+                std::cout << "\t\tview " << view << ": " << count << "\n";
+        }
+
         // 'total'
         int total_in_A = p_idxA->orderedKeys().size();  // assumes sizeA == sizeB
         double percent_diff = (double)this->differences() / (double)total_in_A * 100.0;
@@ -290,6 +572,55 @@ void ComparisonResult::writeOnlyB(const std::string& filename) const {
 }
 
 
+/******************************/
+/***** RegionMapper class *****/
+/******************************/
+RegionMapper::RegionMapper(const std::vector<std::string>& tableA,
+                           const std::vector<std::string>& tableB) : p_tableA(tableA), p_tableB(tableB) {
+    p_identical = (tableA == tableB);
+    if (tableA.empty() || tableB.empty())
+        return;
+
+    std::unordered_map<std::string, int32_t> idsB;
+    idsB.reserve(tableB.size());
+    for (size_t i = 0; i < tableB.size(); i++)
+        idsB.emplace(tableB[i], (int32_t)i);
+
+    p_aToB.resize(tableA.size(), UNMAPPED);
+    for (size_t i = 0; i < tableA.size(); i++) {
+        auto it = idsB.find(tableA[i]);
+        if (it != idsB.end())
+            p_aToB[i] = it->second;
+    }
+}
+
+void RegionMapper::p_resolve(Shot& s, const std::vector<std::string>& table) {
+    for (auto &part : s.parts) {
+        if (part.region_id >= 0 && (size_t)part.region_id < table.size()) {
+            part.region = table[part.region_id];
+            part.region_id = -1;
+        }
+    }
+}
+
+void RegionMapper::align(Shot& a, Shot& b) const {
+    // both with tables: translate A's ids into B's table
+    if (!p_aToB.empty()) {
+        for (auto &part : a.parts) {
+            if (part.region_id >= 0)
+                part.region_id = ((size_t)part.region_id < p_aToB.size()) ? p_aToB[part.region_id] : UNMAPPED;
+        }
+        return;
+    }
+
+    // at most one side has ids - compare by name
+    if (!p_tableA.empty())
+        p_resolve(a, p_tableA);
+    if (!p_tableB.empty())
+        p_resolve(b, p_tableB);
+}
+
+
 /*****************************************/
 /***** shot helper utility functions *****/
 /*****************************************/
@@ -354,6 +685,93 @@ inline const char* _parse_xyz_fields(const char* p,
     return (!p || (*p != '}')) ? NULL : p+1;
 }
 
+bool shot_utils::parse_json_id(const std::string& jsonLine, int64_t& idx, int& view) noexcept {
+    // NOTE: the id fields, when present, lead the record:
+    // {"ray_idx":N,"view":V,"partitions":[..
+    static const char idx_key[] = "{\"ray_idx\":";
+    static const char view_key[] = ",\"view\":";
+    const char *p   = jsonLine.c_str();
+    const char *end = p + jsonLine.size();
+
+    if (jsonLine.compare(0, sizeof(idx_key) - 1, idx_key) != 0)
+        return false;
+    p += sizeof(idx_key) - 1;
+    int64_t i;
+    auto r = std::from_chars(p, end, i);
+    if (r.ec != std::errc())
+        return false;
+    p = r.ptr;
+
+    if ((size_t)(end - p) < sizeof(view_key) - 1 || std::strncmp(p, view_key, sizeof(view_key) - 1) != 0)
+        return false;
+    p += sizeof(view_key) - 1;
+    int v;
+    if (std::from_chars(p, end, v).ec != std::errc())
+        return false;
+
+    idx = i;
+    view = v;
+    return true;
+}
+
+bool shot_utils::is_pipe(const std::string& path) noexcept {
+    std::error_code ec;
+    return path == "-" || std::filesystem::is_fifo(path, ec);
+}
+
+bool shot_utils::is_region_table(const std::string& line) noexcept {
+    return line.compare(0, 16, "{\"region_table\":") == 0;
+}
+
+bool shot_utils::parse_region_table(const std::string& line, std::vector<std::string>& names) {
+    // {"region_table":["name0","name1",..]}
+    names.clear();
+    if (!is_region_table(line))
+        return false;
+    size_t p = line.find('[');
+    if (p == std::string::npos)
+        return false;
+    p++;
+    while (p < line.size() && line[p] == '"') {
+        size_t term = line.find('"', p + 1);
+        if (term == std::string::npos)
+            return false;
+        names.emplace_back(line, p + 1, term - p - 1);
+        p = term + 1;
+        if (p < line.size() && line[p] == ',')
+            p++;
+    }
+    return true;
+}
+
+bool shot_utils::read_region_table(const std::string& filename, std::vector<std::string>& names) {
+    names.clear();
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open())
+        return false;
+    in.seekg(0, std::ios::end);
+    size_t size = in.tellg();
+
+    // the table is the last line; read back far enough to find its start
+    size_t tail = std::min<size_t>(size, 64 * 1024);
+    while (tail) {
+        std::string buf(tail, '\0');
+        in.seekg(size - tail, std::ios::beg);
+        in.read(&buf[0], tail);
+
+        size_t last = buf.find_last_not_of('\n');
+        if (last == std::string::npos)
+            return false;
+        size_t nl = buf.rfind('\n', last);
+        if (nl != std::string::npos || tail == size) {
+            size_t start = (nl == std::string::npos) ? 0 : nl + 1;
+            return parse_region_table(buf.substr(start, last + 1 - start), names);
+        }
+        tail = std::min(size, tail * 4);
+    }
+    return false;
+}
+
 Shot::Ray shot_utils::parse_json_ray(const std::string& jsonLine) {
     // NOTE: assumes the form (ordering, naming, and quoting matter):
     // {..json.. "ray_dir":"{"X":"VAL","Z":"VAL","Z":"VAL"},"ray_pt":{"X":"VAL","Z":"VAL","Z":"VAL"}}
@@ -394,21 +812,33 @@ Shot shot_utils::parse_json_shot(const std::string &jsonLine) {
             // in_norm
             p = _parse_xyz_fields(p, end, "in_norm", part.in_norm);
             if (!p) break;
-            // in_pt
-            p = _parse_xyz_fields(p, end, "in_pt", part.in);
-            if (!p) break;
+            // in_pt - rebuilt from the ray in compact results
+            if (std::strncmp(p, ",\"in_pt\"", 8) == 0) {
+                p = _parse_xyz_fields(p, end, "in_pt", part.in);
+                if (!p) break;
+            } else {
+                shot.derived_pts = true;
+            }
             // out_dist
             p = _parse_quoted_double(p, end, "\"out_dist\":\"", part.out_dist);
             // out_norm
             p = _parse_xyz_fields(p, end, "out_norm", part.out_norm);
             if (!p) break;
             // out_pt
-            p = _parse_xyz_fields(p, end, "out_pt", part.out);
-            if (!p) break;
+            if (std::strncmp(p, ",\"out_pt\"", 9) == 0) {
+                p = _parse_xyz_fields(p, end, "out_pt", part.out);
+                if (!p) break;
+            } else {
+                shot.derived_pts = true;
+            }
 
-            // region
-            p = std::strstr(p, "\"region\":\"");
-            if (p) {
+            // region - an id into the file's region table, or the full name
+            if (std::strncmp(p, ",\"region_id\":", 13) == 0) {
+                p += 13;
+                auto r = std::from_chars(p, end, part.region_id);
+                if (r.ec != std::errc()) break;
+                p = r.ptr;
+            } else if ((p = std::strstr(p, "\"region\":\""))) {
                 p += std::strlen("\"region\":\"");
                 const char *start = p;
                 const char *term  = std::strchr(p, '"');
@@ -427,15 +857,29 @@ Shot shot_utils::parse_json_shot(const std::string &jsonLine) {
         }
     }
 
+    /* ray index and view, if recorded */
+    shot_utils::parse_json_id(jsonLine, shot.idx, shot.view);
+
     /* ray pt and dir */
     Shot::Ray ray = shot_utils::parse_json_ray(jsonLine);
     VMOVE(shot.ray.dir, ray.dir);
     VMOVE(shot.ray.pt, ray.pt);
 
+    /* compact results: hit points are on the ray, same math as librt's */
+    if (shot.derived_pts) {
+        for (auto &part : shot.parts) {
+            VJOIN1(part.in, shot.ray.pt, part.in_dist, shot.ray.dir);
+            VJOIN1(part.out, shot.ray.pt, part.out_dist, shot.ray.dir);
+        }
+    }
+
     return shot;
 }
 
-bool shot_utils::shot_equal_at_tol(const Shot* shotA, const Shot* shotB, const double tol) {
+bool shot_utils::shot_equal_at_tol(const Shot* shotA, const Shot* shotB, const double tol, bool compare_derived) {
+    // points rebuilt from distances only repeat the distance comparison
+    bool cmp_pts = compare_derived || (!shotA->derived_pts && !shotB->derived_pts);
+
     // compare ray origin & direction
     if (!VNEAR_EQUAL(shotA->ray.pt,  shotB->ray.pt,  tol) ||
         !VNEAR_EQUAL(shotA->ray.dir, shotB->ray.dir, tol)) {
@@ -452,16 +896,42 @@ bool shot_utils::shot_equal_at_tol(const Shot* shotA, const Shot* shotB, const d
         const auto &pa = shotA->parts[i];
         const auto &pb = shotB->parts[i];
 
-        if (pa.region != pb.region ||
-            !VNEAR_EQUAL(pa.in,       pb.in,       tol) ||
+        bool same_region = (pa.region_id != -1 || pb.region_id != -1) ? pa.region_id == pb.region_id : pa.region == pb.region;
+        if (!same_region ||
+            (cmp_pts && !VNEAR_EQUAL(pa.in, pb.in, tol)) ||
             !VNEAR_EQUAL(pa.in_norm,  pb.in_norm,  tol) ||
             !NEAR_EQUAL( pa.in_dist,  pb.in_dist,  tol) ||
-            !VNEAR_EQUAL(pa.out,      pb.out,      tol) ||
+            (cmp_pts && !VNEAR_EQUAL(pa.out, pb.out, tol)) ||
             !VNEAR_EQUAL(pa.out_norm, pb.out_norm, tol) ||
             !NEAR_EQUAL( pa.out_dist, pb.out_dist, tol)) {
             return false;
         }
     }
 
+    return true;
+}
+
+bool shot_utils::shot_identical(const Shot* shotA, const Shot* shotB) noexcept {
+    if (shotA->idx != shotB->idx || shotA->view != shotB->view ||
+        std::memcmp(shotA->ray.pt, shotB->ray.pt, sizeof(point_t)) != 0 ||
+        std::memcmp(shotA->ray.dir, shotB->ray.dir, sizeof(vect_t)) != 0 ||
+        shotA->parts.size() != shotB->parts.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < shotA->parts.size(); ++i) {
+        const auto &pa = shotA->parts[i];
+        const auto &pb = shotB->parts[i];
+        if (pa.region != pb.region || pa.region_id != pb.region_id ||
+            std::memcmp(pa.in, pb.in, sizeof(point_t)) != 0 ||
+            std::memcmp(pa.in_norm, pb.in_norm, sizeof(vect_t)) != 0 ||
+            std::memcmp(&pa.in_dist, &pb.in_dist, sizeof(double)) != 0 ||
+            std::memcmp(pa.out, pb.out, sizeof(point_t)) != 0 ||
+            std::memcmp(pa.out_norm, pb.out_norm, sizeof(vect_t)) != 0 ||
+            std::memcmp(&pa.out_dist, &pb.out_dist, sizeof(double)) != 0) {
+            return false;
+        }
+    }
+
     return true;
 }
\ No newline at end of file
@@ -4,30 +4,76 @@
 #include <vector>
 #include <unordered_map>
 #include <optional>
+#include <map>
 #include <fstream>
 #include <mutex>                    // needed?
 
 #include "json.hpp"                 // nlohmann::json
 #include "Shot.h"                   // existing Shot, Ray, Partition definitions
 #include "comp/compare_config.h"    // config struct (needed?)
+#include "comp/shotbin.h"           // binary shot files
+
+struct bu_mapped_file;
 
 /* Auxiliary helper functions. Handle method specific reading / writing */
 namespace shot_utils {
     // computes hash on ray origin + direction
     uint64_t hash_ray(const Shot::Ray& ray) noexcept;
 
+    // parse the leading "ray_idx"/"view" fields; false if the shot has none
+    bool parse_json_id(const std::string& line, int64_t& idx, int& view) noexcept;
+
+    // region table written at the end of results with region ids
+    bool is_region_table(const std::string& line) noexcept;
+    bool parse_region_table(const std::string& line, std::vector<std::string>& names);
+    bool read_region_table(const std::string& filename, std::vector<std::string>& names);
+
+    // "-" (standard input/output) or a named pipe - read once, front to back
+    bool is_pipe(const std::string& path) noexcept;
+
     // parse a JSON object {"X":...,"Y":...,"Z":...} into Shot::Ray
     Shot::Ray parse_json_ray(const std::string& line);
 
     // parse a NDJSON line into Shot
     Shot parse_json_shot(const std::string &line);
 
-    // compares shots values within tolerance; returns true if equal
+    // compares shots values within tolerance; returns true if equal.
+    // hit points rebuilt from compact results are skipped unless compare_derived
     // TODO: should probably be a Shot class function
-    bool shot_equal_at_tol(const Shot* shotA, const Shot* shotB, const double tolerance);
+    bool shot_equal_at_tol(const Shot* shotA, const Shot* shotB, const double tolerance, bool compare_derived = false);
+
+    // bit for bit identical shots (duplicates in one file)
+    bool shot_identical(const Shot* shotA, const Shot* shotB) noexcept;
+};
+
+/* Lines up two files' region tables once, so partitions written with
+ * region ids can be compared id to id instead of name to name.  Files
+ * without a table keep their names; the other side is resolved to match */
+class RegionMapper {
+public:
+    RegionMapper(const std::vector<std::string>& tableA, const std::vector<std::string>& tableB);
+
+    // the tables agree id for id - identical records are identical shots
+    bool identical() const noexcept { return p_identical; }
+
+    // bring a shot from A and one from B to comparable region ids or names
+    void align(Shot& a, Shot& b) const;
+private:
+    const std::vector<std::string>& p_tableA;
+    const std::vector<std::string>& p_tableB;
+    std::vector<int32_t> p_aToB;        // A's ids in B's table (UNMAPPED if B has no such region)
+    bool p_identical{false};
+
+    static constexpr int32_t UNMAPPED = -2;
+    static void p_resolve(Shot& s, const std::vector<std::string>& table);
 };
 
-/* Indexes a large NDJSON shot file into (file-offset, hash) pairs */
+/* Indexes a large NDJSON or binary shot file into (file-offset, key) pairs.
+ * Binary files are mapped and decoded in place; compressed ones a segment
+ * at a time, as lookups reach it.
+ * Files that record ray indices are keyed (and addressed) by ray index,
+ * everything else by ray hash.  Both files of a compare must agree - see
+ * rekeyByHash() */
 class ShotIndex {
 public:
     explicit ShotIndex(const std::string& filename);
@@ -39,23 +85,55 @@ public:
     // returns filename for associated shotIndex
     std::string filename() const noexcept;
 
+    // region names for partitions written with region ids (empty if none)
+    const std::vector<std::string>& regionTable() const noexcept;
+
+    // keys are ray indices rather than ray hashes
+    bool keyedByRayIndex() const noexcept;
+
+    // re-index by ray hash (to compare against a file without ray indices)
+    void rekeyByHash();
+
     // order using file offset so we can iterate in sequential chunks
-    const std::vector<std::pair<uint64_t, uint64_t>>& orderedKeys() const noexcept;  // <file_offset, ray_hash>
+    const std::vector<std::pair<uint64_t, uint64_t>>& orderedKeys() const noexcept;  // <file_offset, key>
 
-    // lookup rayHash; returns either map value or std::nullopt (thread safe)
-    std::optional<uint64_t> lookup(uint64_t rayHash) const noexcept;
+    // lookup key; returns either file offset or std::nullopt (thread safe)
+    std::optional<uint64_t> lookup(uint64_t key) const noexcept;
     
-    // get full shot for rayHash; returns Shot or std::nullopt (NOT thread safe)
-    std::optional<Shot> getShot(uint64_t rayHash) const;
+    // get full shot for key; returns Shot or std::nullopt (NOT thread safe)
+    std::optional<Shot> getShot(uint64_t key) const;
 private:
     std::string p_filename;
     std::ifstream p_file;
     bool p_valid{false};
 
-    std::vector<std::pair<uint64_t, uint64_t>> p_ordered_keys;  // <file_offset, ray_hash>
+    bool p_by_index{false};
+    std::vector<std::string> p_regions;
+
+    std::vector<std::pair<uint64_t, uint64_t>> p_ordered_keys;  // <file_offset, key>
     std::unordered_map<uint64_t, uint64_t> p_offset_map;        // hashed ray pt+dir -> file offset
+    std::vector<uint64_t> p_index_offsets;                      // ray index - p_index_base -> file offset (NO_OFFSET if absent)
+    uint64_t p_index_base{0};                                   // lowest ray index p_index_offsets covers (shards start past 0)
+    uint64_t p_max_span{UINT64_MAX};                            // widest p_index_offsets may get - a few times the shots the file can hold
+    bool p_dense{true};                                         // false: ray indices too sparse, kept in p_offset_map
+    static constexpr uint64_t NO_OFFSET = UINT64_MAX;
+    static constexpr uint64_t INDEX_SPAN_PER_SHOT = 4;          // p_max_span: table slots allowed per shot in the file
+    static constexpr uint64_t MIN_INDEX_SPAN = 65536;           // ... and at least this many
+    static constexpr uint64_t MIN_SHOT_LINE_BYTES = 64;         // no NDJSON shot line is shorter (bounds the shot count)
+
+    // binary shot files
+    bool p_binary{false};
+    bool p_compressed{false};
+    struct bu_mapped_file* p_map{NULL};
+    std::vector<uint64_t> p_seg_offsets;                        // (decoded) file offset of each segment
+    std::vector<uint64_t> p_seg_starts;                         // compressed files: where each segment is in the map
+    std::vector<shotbin::SegmentView> p_segs;                   // uncompressed files: every segment, in place
+    uint64_t p_serial{0};                                       // tells this index's segments apart in the decode cache
 
     void p_buildIndex();                                        // main driver: iterate over file and load map
+    void p_buildBinaryIndex();                                  // p_buildIndex for binary files
+    void p_addKey(uint64_t key, uint64_t offset);
+    const shotbin::SegmentView* p_segment(size_t s) const;     // view of segment s (NULL if it does not decode)
 };
 
 /* fully compare two ShotIndex at tolerance */
@@ -64,7 +142,8 @@ public:
     ComparisonResult(const ShotIndex& idxA,
                      const ShotIndex& idxB,
                      double tolerance,
-                     int nThreads = 0);     // default (0): use all available CPU
+                     int nThreads = 0,      // default (0): use all available CPU
+                     bool compareDerived = false);  // also compare rebuilt hit points
 
     // returns total number of differences
     int differences() const noexcept { return p_differing.size() + p_onlyA.size() + p_onlyB.size(); }
@@ -82,11 +161,14 @@ private:
     std::vector<uint64_t> p_differing;  // same ray-hash but mismatched data
     std::vector<uint64_t> p_onlyA;      // in A but not in B
     std::vector<uint64_t> p_onlyB;      // in B but not in A
+    std::map<int, size_t> p_viewDiffs;  // view -> differing + onlyA shots (when views are recorded)
 
     // compare inputs
     const ShotIndex* p_idxA;
     const ShotIndex* p_idxB;
     const double p_tolerance;
+    const bool p_compareDerived;
+    RegionMapper p_regionMap;
 
     // protects writes into the shared vectors
     // TODO: bu_mutex
@@ -0,0 +1,609 @@
+#include "shotbin.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <brlcad/bu.h>
+
+#include "shot_comp.h"
+#include "jsonwriter.hpp"
+
+/**********************************/
+/***** SegmentBuilder class *******/
+/**********************************/
+template <typename T>
+static void _append(std::string& out, const std::vector<T>& v) {
+    out.append((const char*)v.data(), v.size() * sizeof(T));
+}
+
+static void _pad(std::string& out, size_t start) {
+    out.append(shotbin::pad8(out.size() - start) - (out.size() - start), '\0');
+}
+
+void shotbin::SegmentBuilder::serialize(std::string& out) {
+    // compressed: lay the segment out as usual, then encode it
+    if (compressed) {
+        compressed = false;
+        raw.clear();
+        serialize(raw);
+        compressed = true;
+        compressSegment(raw.data(), (compact) ? FLAG_COMPACT : 0, out);
+        return;
+    }
+
+    SegHeader h;
+    std::memcpy(h.magic, SEG_MAGIC, sizeof(h.magic));
+    h.nshots = (uint32_t)shots.size();
+    h.nparts = (uint32_t)in_dist.size();
+    h.nregions = (uint32_t)regions.size();
+    h.bytes = bytes();
+
+    size_t start = out.size();
+    out.reserve(start + h.bytes);
+    out.append((const char*)&h, sizeof(h));
+    _append(out, shots);
+    _append(out, in_dist);
+    _append(out, out_dist);
+    _append(out, in_pt);
+    _append(out, in_norm);
+    _append(out, out_pt);
+    _append(out, out_norm);
+    _append(out, region);
+    _pad(out, start);
+    for (const std::string& name : regions) {
+        uint32_t len = (uint32_t)name.size();
+        out.append((const char*)&len, sizeof(len));
+        out.append(name);
+    }
+    _pad(out, start);
+
+    // start the next segment from scratch; keep the vector storage
+    shots.clear();
+    in_dist.clear();
+    out_dist.clear();
+    in_pt.clear();
+    in_norm.clear();
+    out_pt.clear();
+    out_norm.clear();
+    region.clear();
+    regions.clear();
+    region_ids.clear();
+    region_bytes = 0;
+}
+
+
+/******************************/
+/***** XOR-delta encoding *****/
+/******************************/
+/* word sections of a segment body (everything before the region table):
+ * count of 8 byte words and the distance back to the same field */
+static size_t _sections(const shotbin::SegHeader& h, uint32_t flags, size_t count[8], size_t stride[8]) {
+    size_t n = 0;
+    bool compact = (flags & shotbin::FLAG_COMPACT);
+    auto add = [&](size_t c, size_t s) { count[n] = c; stride[n] = s; n++; };
+    add(h.nshots * (sizeof(shotbin::ShotRec) / 8), sizeof(shotbin::ShotRec) / 8);
+    add(h.nparts, 1);                   // in_dist
+    add(h.nparts, 1);                   // out_dist
+    if (!compact)
+        add(h.nparts * 3, 3);           // in_pt
+    add(h.nparts * 3, 3);               // in_norm
+    if (!compact)
+        add(h.nparts * 3, 3);           // out_pt
+    add(h.nparts * 3, 3);               // out_norm
+    add(shotbin::pad8(h.nparts * sizeof(uint32_t)) / 8, 1);    // region ids
+    return n;
+}
+
+/* pairs of values: one byte holding both lengths, then their low bytes */
+static void _xor_encode(const uint64_t* w, size_t n, size_t stride, std::string& out) {
+    for (size_t i = 0; i < n; i += 2) {
+        uint64_t x[2] = {0, 0};
+        int nb[2] = {0, 0};
+        for (int k = 0; k < 2 && i + k < n; k++) {
+            size_t j = i + k;
+            x[k] = w[j] ^ ((j >= stride) ? w[j - stride] : 0);
+            while (nb[k] < 8 && (x[k] >> (8 * nb[k])))
+                nb[k]++;
+        }
+        out.push_back((char)(nb[0] | (nb[1] << 4)));
+        for (int k = 0; k < 2; k++) {
+            for (int b = 0; b < nb[k]; b++)
+                out.push_back((char)(x[k] >> (8 * b)));
+        }
+    }
+}
+
+static const char* _xor_decode(const char* p, const char* end, uint64_t* w, size_t n, size_t stride) {
+    for (size_t i = 0; i < n; i += 2) {
+        if (p >= end)
+            return NULL;
+        unsigned char lens = (unsigned char)*p++;
+        int nb[2] = {lens & 0xf, lens >> 4};
+        for (int k = 0; k < 2 && i + k < n; k++) {
+            if (nb[k] > 8 || end - p < nb[k])
+                return NULL;
+            uint64_t x = 0;
+            for (int b = 0; b < nb[k]; b++)
+                x |= (uint64_t)(unsigned char)*p++ << (8 * b);
+            size_t j = i + k;
+            w[j] = x ^ ((j >= stride) ? w[j - stride] : 0);
+        }
+    }
+    return p;
+}
+
+/* compressed segment:
+ *   SegHeader (SEGZ_MAGIC, bytes = compressed size)
+ *   uint64 raw_bytes                   size of the decoded segment
+ *   encoded word sections
+ *   region table, as is
+ *   padding to 8 */
+void shotbin::compressSegment(const char* seg, uint32_t flags, std::string& out) {
+    const SegHeader* raw = (const SegHeader*)seg;
+    size_t start = out.size();
+    SegHeader h = *raw;
+    std::memcpy(h.magic, SEGZ_MAGIC, sizeof(h.magic));
+    out.append((const char*)&h, sizeof(h));
+    uint64_t raw_bytes = raw->bytes;
+    out.append((const char*)&raw_bytes, sizeof(raw_bytes));
+
+    size_t count[8], stride[8];
+    size_t nsec = _sections(*raw, flags, count, stride);
+    const uint64_t* w = (const uint64_t*)(seg + sizeof(SegHeader));
+    for (size_t s = 0; s < nsec; s++) {
+        _xor_encode(w, count[s], stride[s], out);
+        w += count[s];
+    }
+
+    const char* table = (const char*)w;
+    out.append(table, seg + raw->bytes - table);
+    _pad(out, start);
+    ((SegHeader*)&out[start])->bytes = out.size() - start;
+}
+
+bool shotbin::decompressSegment(const char* buf, size_t avail, uint32_t flags, std::string& out) {
+    if (avail < sizeof(SegHeader) + sizeof(uint64_t))
+        return false;
+    SegHeader h;
+    std::memcpy(&h, buf, sizeof(h));
+    if (std::memcmp(h.magic, SEGZ_MAGIC, sizeof(h.magic)) != 0 || h.bytes > avail)
+        return false;
+    uint64_t raw_bytes;
+    std::memcpy(&raw_bytes, buf + sizeof(h), sizeof(raw_bytes));
+
+    size_t count[8], stride[8];
+    size_t nsec = _sections(h, flags, count, stride);
+    size_t words = 0;
+    for (size_t s = 0; s < nsec; s++)
+        words += count[s];
+    if (sizeof(SegHeader) + words * 8 > raw_bytes)
+        return false;
+
+    out.assign(raw_bytes, '\0');
+    std::memcpy(h.magic, SEG_MAGIC, sizeof(h.magic));
+    h.bytes = raw_bytes;
+    std::memcpy(&out[0], &h, sizeof(h));
+
+    const char* p = buf + sizeof(SegHeader) + sizeof(uint64_t);
+    const char* end = buf + ((const SegHeader*)buf)->bytes;
+    uint64_t* w = (uint64_t*)&out[sizeof(SegHeader)];
+    for (size_t s = 0; s < nsec; s++) {
+        p = _xor_decode(p, end, w, count[s], stride[s]);
+        if (!p)
+            return false;
+        w += count[s];
+    }
+
+    size_t table = raw_bytes - sizeof(SegHeader) - words * 8;
+    if ((size_t)(end - p) < table)
+        return false;
+    std::memcpy(w, p, table);
+    return true;
+}
+
+
+/*******************************/
+/***** SegmentView class *******/
+/*******************************/
+bool shotbin::SegmentView::init(const char* buf, size_t avail, uint32_t flags) {
+    compact = (flags & FLAG_COMPACT);
+    if (avail < sizeof(SegHeader))
+        return false;
+    hdr = (const SegHeader*)buf;
+    if (std::memcmp(hdr->magic, SEG_MAGIC, sizeof(hdr->magic)) != 0 || hdr->bytes > avail)
+        return false;
+
+    // fixed-size sections must fit before the region table
+    size_t nparts = hdr->nparts;
+    size_t fixed = sizeof(SegHeader) + hdr->nshots * sizeof(ShotRec)
+                   + nparts * ((compact) ? 8 : 14) * sizeof(double) + pad8(nparts * sizeof(uint32_t));
+    if (fixed > hdr->bytes)
+        return false;
+
+    const char* p = buf + sizeof(SegHeader);
+    shots = (const ShotRec*)p;          p += hdr->nshots * sizeof(ShotRec);
+    in_dist = (const double*)p;         p += nparts * sizeof(double);
+    out_dist = (const double*)p;        p += nparts * sizeof(double);
+    if (!compact) {
+        in_pt = (const double*)p;       p += nparts * 3 * sizeof(double);
+    }
+    in_norm = (const double*)p;         p += nparts * 3 * sizeof(double);
+    if (!compact) {
+        out_pt = (const double*)p;      p += nparts * 3 * sizeof(double);
+    }
+    out_norm = (const double*)p;        p += nparts * 3 * sizeof(double);
+    region = (const uint32_t*)p;        p += pad8(nparts * sizeof(uint32_t));
+
+    const char* end = buf + hdr->bytes;
+    regions.clear();
+    regions.reserve(hdr->nregions);
+    for (uint32_t i = 0; i < hdr->nregions; i++) {
+        uint32_t len;
+        if (end - p < (ptrdiff_t)sizeof(len))
+            return false;
+        std::memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if (end - p < (ptrdiff_t)len)
+            return false;
+        regions.emplace_back(p, len);
+        p += len;
+    }
+
+    // every partition has to point inside the columns and region table
+    for (uint32_t i = 0; i < hdr->nshots; i++) {
+        if ((uint64_t)shots[i].part_first + shots[i].part_count > nparts)
+            return false;
+    }
+    for (size_t i = 0; i < nparts; i++) {
+        if (region[i] >= hdr->nregions)
+            return false;
+    }
+    return true;
+}
+
+Shot shotbin::SegmentView::shot(size_t i) const {
+    const ShotRec& r = shots[i];
+    Shot s{ Shot::Ray(0.0) };
+    s.idx = r.idx;
+    s.view = r.view;
+    VMOVE(s.ray.pt, r.pt);
+    VMOVE(s.ray.dir, r.dir);
+    s.derived_pts = compact;
+
+    s.parts.reserve(r.part_count);
+    for (uint32_t k = r.part_first; k < r.part_first + r.part_count; k++) {
+        Shot::Partition part{0.0};
+        part.in_dist = in_dist[k];
+        part.out_dist = out_dist[k];
+        VMOVE(part.in_norm, in_norm + 3 * k);
+        VMOVE(part.out_norm, out_norm + 3 * k);
+        if (compact) {
+            VJOIN1(part.in, r.pt, part.in_dist, r.dir);
+            VJOIN1(part.out, r.pt, part.out_dist, r.dir);
+        } else {
+            VMOVE(part.in, in_pt + 3 * k);
+            VMOVE(part.out, out_pt + 3 * k);
+        }
+        part.region.assign(regions[region[k]]);
+        s.parts.push_back(std::move(part));
+    }
+    return s;
+}
+
+
+bool shotbin::findSegments(const char* buf, size_t len, std::vector<uint64_t>& starts,
+                           std::vector<uint64_t>& offsets) {
+    bool compressed = (fileFlags(buf) & FLAG_COMPRESSED);
+    starts.clear();
+    offsets.clear();
+
+    // their headers give their size either way
+    size_t off = sizeof(FileHeader);
+    uint64_t voff = off;
+    while (off < len) {
+        SegHeader h;
+        if (len - off < sizeof(h)) {
+            std::cerr << "truncated shot segment at offset " << off << std::endl;
+            return false;
+        }
+        std::memcpy(&h, buf + off, sizeof(h));
+        if (h.bytes < sizeof(h) || h.bytes > len - off) {
+            std::cerr << "malformed shot segment at offset " << off << std::endl;
+            return false;
+        }
+        starts.push_back(off);
+        offsets.push_back(voff);
+        off += h.bytes;
+        if (compressed) {
+            uint64_t raw_bytes = 0;
+            if (h.bytes >= sizeof(h) + sizeof(raw_bytes))
+                std::memcpy(&raw_bytes, buf + starts.back() + sizeof(h), sizeof(raw_bytes));
+            voff += raw_bytes;
+        } else {
+            voff += h.bytes;
+        }
+    }
+    return true;
+}
+
+bool shotbin::decodeSegments(const char* buf, size_t len, const uint64_t* starts, size_t count,
+                             std::vector<std::string>& decoded, unsigned nthreads) {
+    uint32_t flags = fileFlags(buf);
+    decoded.resize(count);
+    if (!count)
+        return true;
+
+    // spread over the threads
+    std::atomic<size_t> next{0};
+    std::atomic<bool> ok{true};
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < count) {
+            if (!decompressSegment(buf + starts[i], len - starts[i], flags, decoded[i])) {
+                std::cerr << "malformed compressed shot segment at offset " << starts[i] << std::endl;
+                ok = false;
+            }
+        }
+    };
+    nthreads = std::max(1u, std::min<unsigned>(nthreads, (unsigned)count));
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < nthreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &th : threads)
+        th.join();
+    return ok;
+}
+
+bool shotbin::loadSegments(const char* buf, size_t len, std::vector<SegmentView>& segs,
+                           std::vector<uint64_t>& offsets, std::vector<std::string>& decoded,
+                           unsigned nthreads) {
+    uint32_t flags = fileFlags(buf);
+    bool compressed = (flags & FLAG_COMPRESSED);
+    segs.clear();
+    decoded.clear();
+
+    std::vector<uint64_t> starts;
+    if (!findSegments(buf, len, starts, offsets))
+        return false;
+    if (compressed && !decodeSegments(buf, len, starts.data(), starts.size(), decoded, nthreads))
+        return false;
+
+    segs.resize(starts.size());
+    for (size_t i = 0; i < starts.size(); i++) {
+        const char* s = (compressed) ? decoded[i].data() : buf + starts[i];
+        size_t avail = (compressed) ? decoded[i].size() : len - starts[i];
+        if (!segs[i].init(s, avail, flags)) {
+            std::cerr << "malformed shot segment at offset " << starts[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*****************************/
+/***** format conversion *****/
+/*****************************/
+bool shotbin::isBinaryFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char buf[sizeof(FileHeader)];
+    if (!in.read(buf, sizeof(buf)))
+        return false;
+    return isBinary(buf, sizeof(buf));
+}
+
+/* one NDJSON record, exactly as tsj::Writer writes it */
+static void _shot_to_json(std::string& out, const Shot& s, bool compact) {
+    using namespace tsj::fmt;
+    char tmp[19 * MAX_DOUBLE_CHARS + 256];
+    char *p = tmp;
+
+    if (s.idx >= 0) {
+        p = lit(p, "{\"ray_idx\":");
+        p = std::to_chars(p, tmp + sizeof(tmp), s.idx).ptr;
+        p = lit(p, ",\"view\":");
+        p = std::to_chars(p, tmp + sizeof(tmp), s.view).ptr;
+        p = lit(p, ",\"partitions\":[");
+    } else {
+        p = lit(p, "{\"partitions\":[");
+    }
+    out.append(tmp, p - tmp);
+
+    for (size_t i = 0; i < s.parts.size(); i++) {
+        const Shot::Partition& part = s.parts[i];
+        p = tmp;
+        p = lit(p, "{\"in_dist\":\"");
+        p = num(p, part.in_dist);
+        p = lit(p, "\",\"in_norm\":");
+        p = xyz(p, part.in_norm);
+        if (!compact) {
+            p = lit(p, ",\"in_pt\":");
+            p = xyz(p, part.in);
+        }
+        p = lit(p, ",\"out_dist\":\"");
+        p = num(p, part.out_dist);
+        p = lit(p, "\",\"out_norm\":");
+        p = xyz(p, part.out_norm);
+        if (!compact) {
+            p = lit(p, ",\"out_pt\":");
+            p = xyz(p, part.out);
+        }
+        p = lit(p, ",\"region\":\"");
+        out.append(tmp, p - tmp);
+        out.append(part.region);
+        out.append((i + 1 < s.parts.size()) ? "\"}," : "\"}");
+    }
+
+    p = tmp;
+    p = lit(p, "],\"ray_dir\":");
+    p = xyz(p, s.ray.dir);
+    p = lit(p, ",\"ray_pt\":");
+    p = xyz(p, s.ray.pt);
+    p = lit(p, "}\n");
+    out.append(tmp, p - tmp);
+}
+
+static bool _binary_to_json(const std::string& in, std::ofstream& out) {
+    struct bu_mapped_file* mf = bu_open_mapped_file(in.c_str(), NULL);
+    if (!mf) {
+        std::cerr << "failed to map " << in << std::endl;
+        return false;
+    }
+
+    const char* buf = (const char*)mf->buf;
+    uint32_t flags = shotbin::fileFlags(buf);
+    std::vector<shotbin::SegmentView> segs;
+    std::vector<uint64_t> offsets;
+    std::vector<std::string> decoded;
+    bool ok = shotbin::loadSegments(buf, mf->buflen, segs, offsets, decoded, bu_avail_cpus());
+
+    std::string text;
+    for (size_t s = 0; ok && s < segs.size(); s++) {
+        for (size_t i = 0; i < segs[s].size(); i++)
+            _shot_to_json(text, segs[s].shot(i), (flags & shotbin::FLAG_COMPACT));
+        out.write(text.data(), text.size());
+        text.clear();
+    }
+
+    bu_close_mapped_file(mf);
+    return ok;
+}
+
+static bool _json_to_binary(const std::string& in, std::ofstream& out, bool compress) {
+    std::ifstream ndjson(in, std::ios::binary);
+    if (!ndjson.is_open()) {
+        std::cerr << "failed to open " << in << std::endl;
+        return false;
+    }
+
+    // binary segments carry region names, so resolve any region ids
+    std::vector<std::string> regions;
+    shot_utils::read_region_table(in, regions);
+
+    // compact input stays compact - as told by the first shot with a
+    // partition, since misses have no hit points to leave out either way
+    std::string line;
+    bool compact = false;
+    while (std::getline(ndjson, line)) {
+        if (line.empty() || shot_utils::is_region_table(line))
+            continue;
+        Shot s = shot_utils::parse_json_shot(line);
+        if (!s.parts.empty()) {
+            compact = s.derived_pts;
+            break;
+        }
+    }
+    ndjson.clear();
+    ndjson.seekg(0, std::ios::beg);
+
+    uint32_t flags = (compact) ? shotbin::FLAG_COMPACT : 0;
+    flags |= (compress) ? shotbin::FLAG_COMPRESSED : 0;
+    std::string hdr = shotbin::fileHeader(flags);
+    out.write(hdr.data(), hdr.size());
+
+    shotbin::SegmentBuilder builder;
+    builder.setCompact(compact);
+    builder.setCompressed(compress);
+    std::string seg;
+    while (std::getline(ndjson, line)) {
+        if (line.empty() || shot_utils::is_region_table(line))
+            continue;
+
+        Shot s = shot_utils::parse_json_shot(line);
+        for (Shot::Partition& part : s.parts) {
+            if (part.region_id >= 0 && (size_t)part.region_id < regions.size())
+                part.region = regions[part.region_id];
+        }
+
+        builder.beginShot(s.ray.pt, s.ray.dir, s.idx, s.view);
+        for (const Shot::Partition& part : s.parts)
+            builder.addPartition(part.in_dist, part.in, part.in_norm, part.out_dist, part.out, part.out_norm, part.region.c_str());
+
+        // same segment size the diff run writes
+        if (builder.bytes() >= tsj::StreamWriter::DEFAULT_BLOCK_BYTES) {
+            builder.serialize(seg);
+            out.write(seg.data(), seg.size());
+            seg.clear();
+        }
+    }
+    if (!builder.empty()) {
+        builder.serialize(seg);
+        out.write(seg.data(), seg.size());
+    }
+    return true;
+}
+
+/**********************************/
+/***** ShotFileWriter class *******/
+/**********************************/
+bool shotbin::ShotFileWriter::open(const std::string& path, bool binary, bool compact, bool compress) {
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "failed to open output file: " << path << std::endl;
+        return false;
+    }
+    this->path = path;
+    this->binary = binary;
+    this->compact = compact;
+    if (!binary)
+        return true;
+
+    builder.setCompact(compact);
+    builder.setCompressed(compress);
+    buf = fileHeader(((compact) ? FLAG_COMPACT : 0) | ((compress) ? FLAG_COMPRESSED : 0));
+    out.write(buf.data(), buf.size());
+    return out.good();
+}
+
+bool shotbin::ShotFileWriter::write(const std::vector<Shot>& shots) {
+    buf.clear();
+    if (!binary) {
+        for (const Shot& s : shots)
+            _shot_to_json(buf, s, compact);
+        out.write(buf.data(), buf.size());
+        return out.good();
+    }
+
+    for (size_t i = 0; i < shots.size(); i++) {
+        const Shot& s = shots[i];
+        builder.beginShot(s.ray.pt, s.ray.dir, s.idx, s.view);
+        for (const Shot::Partition& part : s.parts)
+            builder.addPartition(part.in_dist, part.in, part.in_norm, part.out_dist, part.out, part.out_norm, part.region.c_str());
+        if (builder.bytes() >= tsj::StreamWriter::DEFAULT_BLOCK_BYTES || i + 1 == shots.size())
+            builder.serialize(buf);
+    }
+    out.write(buf.data(), buf.size());
+    return out.good();
+}
+
+bool shotbin::ShotFileWriter::close() {
+    out.close();
+    if (out.fail()) {
+        std::cerr << "failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool shotbin::writeShots(const std::string& path, const std::vector<Shot>& shots, bool binary, bool compact, bool compress) {
+    ShotFileWriter w;
+    return w.open(path, binary, compact, compress) && w.write(shots) && w.close();
+}
+
+bool shotbin::convert(const std::string& in, const std::string& out, bool compress) {
+    bool to_json = isBinaryFile(in);
+
+    std::ofstream ofile(out, std::ios::binary | std::ios::trunc);
+    if (!ofile.is_open()) {
+        std::cerr << "failed to open output file: " << out << std::endl;
+        return false;
+    }
+
+    bool ok = (to_json) ? _binary_to_json(in, ofile) : _json_to_binary(in, ofile, compress);
+    if (ok)
+        std::cout << "converted " << in << " to " << ((to_json) ? "NDJSON" : "binary") << " in " << out << "\n";
+    return ok;
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Shot.h"
+
+/* Binary columnar shot file.
+ *
+ * A 16 byte file header followed by independent segments, one per output
+ * block, so threads (and the ordered writer) can emit them without any
+ * global coordination.  Each segment is
+ *
+ *   SegHeader
+ *   ShotRec[nshots]                    fixed size per-shot records
+ *   double in_dist[nparts]             partition columns ...
+ *   double out_dist[nparts]
+ *   double in_pt[nparts][3]            (not in FLAG_COMPACT files)
+ *   double in_norm[nparts][3]
+ *   double out_pt[nparts][3]           (not in FLAG_COMPACT files)
+ *   double out_norm[nparts][3]
+ *   uint32 region[nparts]              ... index into this segment's region table
+ *   region table                       nregions x (uint32 length, chars)
+ *
+ * with every section padded to 8 bytes so a mapped file can be read in
+ * place.  Values are written in host byte order.
+ *
+ * FLAG_COMPRESSED files store each segment XOR-delta encoded instead: every
+ * 8 byte word before the region table is XORed with the same field of the
+ * previous shot/partition (neighbouring rays in a bundle differ in only a
+ * few low bits) and written as a length nibble plus its significant bytes.
+ * Segments stay independent, so they are decoded in parallel and then read
+ * exactly like uncompressed ones.
+ */
+namespace shotbin {
+    constexpr char FILE_MAGIC[8] = {'R', 'T', 'C', 'M', 'P', 'S', 'H', 'T'};
+    constexpr uint32_t VERSION = 1;
+    constexpr char SEG_MAGIC[4] = {'S', 'E', 'G', '1'};
+
+    // hit points are left out and rebuilt from ray origin + dist * dir
+    constexpr uint32_t FLAG_COMPACT = 0x1;
+    // segments are XOR-delta encoded (SEGZ_MAGIC)
+    constexpr uint32_t FLAG_COMPRESSED = 0x2;
+    constexpr char SEGZ_MAGIC[4] = {'S', 'E', 'G', 'Z'};
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;                 // FLAG_* bits
+    };
+
+    struct SegHeader {
+        char magic[4];
+        uint32_t nshots;
+        uint32_t nparts;
+        uint32_t nregions;
+        uint64_t bytes;                 // whole segment, header included
+    };
+
+    struct ShotRec {
+        int64_t idx;                    // ray pool index (-1: not recorded)
+        double pt[3];
+        double dir[3];
+        int32_t view;                   // -1: not recorded
+        uint32_t part_first;            // first partition in the segment columns
+        uint32_t part_count;
+        uint32_t pad;
+    };
+
+    static_assert(sizeof(FileHeader) == 16, "shot file header layout");
+    static_assert(sizeof(SegHeader) == 24, "shot segment header layout");
+    static_assert(sizeof(ShotRec) == 72, "shot record layout");
+
+    inline size_t pad8(size_t n) noexcept { return (n + 7) & ~(size_t)7; }
+
+    /* file header as written at the start of every binary shot file */
+    inline std::string fileHeader(uint32_t flags = 0) {
+        FileHeader h;
+        std::memcpy(h.magic, FILE_MAGIC, sizeof(h.magic));
+        h.version = VERSION;
+        h.flags = flags;
+        return std::string((const char*)&h, sizeof(h));
+    }
+
+    /* does buf start like a binary shot file? */
+    inline bool isBinary(const void* buf, size_t len) noexcept {
+        return len >= sizeof(FileHeader) && std::memcmp(buf, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0;
+    }
+
+    /* does the file at path start like a binary shot file? */
+    bool isBinaryFile(const std::string& path);
+
+    /* header flags of a mapped binary shot file */
+    inline uint32_t fileFlags(const void* buf) noexcept {
+        return ((const FileHeader*)buf)->flags;
+    }
+
+    /* Accumulates shots into column vectors until serialize() turns them
+     * into one segment.  One per producer thread */
+    class SegmentBuilder {
+    public:
+        /* leave hit points out (FLAG_COMPACT files) */
+        void setCompact(bool c) noexcept { compact = c; }
+
+        /* XOR-delta encode segments (FLAG_COMPRESSED files) */
+        void setCompressed(bool c) noexcept { compressed = c; }
+
+        void beginShot(const double pt[3], const double dir[3], int64_t idx, int view) {
+            ShotRec r;
+            std::memset(&r, 0, sizeof(r));
+            r.idx = idx;
+            std::memcpy(r.pt, pt, sizeof(r.pt));
+            std::memcpy(r.dir, dir, sizeof(r.dir));
+            r.view = view;
+            r.part_first = (uint32_t)in_dist.size();
+            shots.push_back(r);
+        }
+
+        void addPartition(double indist, const double inpt[3], const double innorm[3],
+                          double outdist, const double outpt[3], const double outnorm[3],
+                          const char* region_name) {
+            in_dist.push_back(indist);
+            out_dist.push_back(outdist);
+            in_norm.insert(in_norm.end(), innorm, innorm + 3);
+            out_norm.insert(out_norm.end(), outnorm, outnorm + 3);
+            if (!compact) {
+                in_pt.insert(in_pt.end(), inpt, inpt + 3);
+                out_pt.insert(out_pt.end(), outpt, outpt + 3);
+            }
+            region.push_back(regionId(region_name));
+            shots.back().part_count++;
+        }
+
+        bool empty() const noexcept { return shots.empty(); }
+
+        /* size of the segment serialize() would write (uncompressed) */
+        size_t bytes() const noexcept {
+            return sizeof(SegHeader) + shots.size() * sizeof(ShotRec)
+                   + in_dist.size() * (((compact) ? 8 : 14) * sizeof(double))
+                   + pad8(region.size() * sizeof(uint32_t)) + pad8(region_bytes);
+        }
+
+        /* append the segment to out and start over */
+        void serialize(std::string& out);
+
+    private:
+        uint32_t regionId(const char* name) {
+            auto it = region_ids.find(name);
+            if (it != region_ids.end())
+                return it->second;
+            uint32_t id = (uint32_t)regions.size();
+            regions.emplace_back(name);
+            region_ids.emplace(regions.back(), id);
+            region_bytes += sizeof(uint32_t) + regions.back().size();
+            return id;
+        }
+
+        std::vector<ShotRec> shots;
+        std::vector<double> in_dist, out_dist;
+        std::vector<double> in_pt, in_norm, out_pt, out_norm;
+        std::vector<uint32_t> region;
+        std::vector<std::string> regions;
+        std::unordered_map<std::string, uint32_t> region_ids;
+        size_t region_bytes = 0;
+        bool compact = false;
+        bool compressed = false;
+        std::string raw;                // scratch for compressed segments
+    };
+
+    /* encode the serialize()d segment seg onto out; flags are the file's */
+    void compressSegment(const char* seg, uint32_t flags, std::string& out);
+
+    /* decode the compressed segment at buf back to its serialize() form */
+    bool decompressSegment(const char* buf, size_t avail, uint32_t flags, std::string& out);
+
+    /* Read-only view of one segment of a mapped shot file */
+    class SegmentView {
+    public:
+        /* point at the segment starting at buf; false if it is malformed.
+         * flags are the file header's */
+        bool init(const char* buf, size_t avail, uint32_t flags);
+
+        size_t size() const noexcept { return hdr->nshots; }
+        uint64_t bytes() const noexcept { return hdr->bytes; }
+        const ShotRec& rec(size_t i) const noexcept { return shots[i]; }
+
+        /* decode shot i */
+        Shot shot(size_t i) const;
+
+    private:
+        const SegHeader* hdr = NULL;
+        const ShotRec* shots = NULL;
+        const double *in_dist = NULL, *out_dist = NULL;
+        const double *in_pt = NULL, *in_norm = NULL, *out_pt = NULL, *out_norm = NULL;
+        const uint32_t* region = NULL;
+        std::vector<std::string_view> regions;
+        bool compact = false;
+    };
+
+    /* Find the segments of the mapped shot file buf: starts[i] is where
+     * segment i is in buf, offsets[i] where it starts in the decoded file
+     * (the same unless the file is compressed) */
+    bool findSegments(const char* buf, size_t len, std::vector<uint64_t>& starts,
+                      std::vector<uint64_t>& offsets);
+
+    /* Decode the count compressed segments of buf starting at starts[0..count)
+     * into decoded[0..count), spread over nthreads threads */
+    bool decodeSegments(const char* buf, size_t len, const uint64_t* starts, size_t count,
+                        std::vector<std::string>& decoded, unsigned nthreads);
+
+    /* View every segment of the mapped shot file buf, for a full scan.
+     * offsets[i] is where segment i starts in the decoded file - its
+     * position in buf unless the file is compressed, in which case all
+     * segments are decoded (by nthreads threads) into decoded and the views
+     * point there.  Random access readers should findSegments() and decode
+     * only what they read */
+    bool loadSegments(const char* buf, size_t len, std::vector<SegmentView>& segs,
+                      std::vector<uint64_t>& offsets, std::vector<std::string>& decoded,
+                      unsigned nthreads);
+
+    /* Rewrite a shot file in the other format (binary <-> NDJSON); the
+     * direction is picked from the input */
+    bool convert(const std::string& in, const std::string& out, bool compress = false);
+
+    /* Writes shots to a new shot file, binary or NDJSON, as a diff run
+     * would - a batch at a time, so the whole file need not be in memory */
+    class ShotFileWriter {
+    public:
+        bool open(const std::string& path, bool binary, bool compact, bool compress);
+
+        /* append shots (a binary segment ends with each batch at the latest) */
+        bool write(const std::vector<Shot>& shots);
+
+        bool close();
+
+    private:
+        std::ofstream out;
+        std::string path;
+        std::string buf;
+        SegmentBuilder builder;
+        bool binary = false;
+        bool compact = false;
+    };
+
+    /* write shots to a new shot file, binary or NDJSON, as a diff run would */
+    bool writeShots(const std::string& path, const std::vector<Shot>& shots, bool binary, bool compact, bool compress);
+};
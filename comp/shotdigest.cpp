@@ -0,0 +1,146 @@
+#include "shotdigest.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+bool shotdigest::isDigestFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    char buf[sizeof(FILE_MAGIC)];
+    if (!in.read(buf, sizeof(buf)))
+        return false;
+    return std::memcmp(buf, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0;
+}
+
+bool shotdigest::load(const std::string& path, File& f) {
+    std::ifstream in(path, std::ios::binary);
+    FileHeader h;
+    if (!in.read((char*)&h, sizeof(h)) || std::memcmp(h.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+        std::cerr << "not a digest file: " << path << std::endl;
+        return false;
+    }
+    if (h.version != VERSION) {
+        std::cerr << "unsupported digest file version " << h.version << ": " << path << std::endl;
+        return false;
+    }
+    f.tol = h.tol;
+
+    std::string name((h.detail_len + 7) & ~(size_t)7, '\0');
+    if (!in.read(&name[0], name.size())) {
+        std::cerr << "truncated digest file: " << path << std::endl;
+        return false;
+    }
+    name.resize(h.detail_len);
+    f.detail = name;
+    if (!name.empty() && !std::filesystem::exists(name)) {
+        std::filesystem::path beside = std::filesystem::path(path).parent_path() / std::filesystem::path(name).filename();
+        if (std::filesystem::exists(beside))
+            f.detail = beside.string();
+    }
+
+    // records run to the end of the file
+    std::streampos start = in.tellg();
+    in.seekg(0, std::ios::end);
+    size_t bytes = (size_t)(in.tellg() - start);
+    in.seekg(start);
+    if (bytes % sizeof(Rec))
+        std::cerr << "digest file " << path << " ends in a partial record, ignoring it" << std::endl;
+    f.recs.resize(bytes / sizeof(Rec));
+    if (!in.read((char*)f.recs.data(), f.recs.size() * sizeof(Rec))) {
+        std::cerr << "failed to read digests from " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool shotdigest::writeTree(const std::string& results, double tol, const std::vector<ChunkNode>& chunks) {
+    Tree t;
+    std::memset(&t.hdr, 0, sizeof(t.hdr));
+    std::memcpy(t.hdr.magic, TREE_MAGIC, sizeof(t.hdr.magic));
+    t.hdr.version = VERSION;
+    t.hdr.nchunks = chunks.size();
+    t.hdr.tol = tol;
+    std::error_code ec;
+    t.hdr.file_bytes = std::filesystem::file_size(results, ec);
+
+    // consecutive chunks of the same view make up its node
+    t.hdr.root = 0x9e3779b97f4a7c15ULL;
+    for (size_t c = 0; c < chunks.size(); c++) {
+        if (t.views.empty() || t.views.back().view != chunks[c].view) {
+            if (!t.views.empty())
+                t.hdr.root = combine(t.hdr.root, t.views.back().hash);
+            ViewNode v;
+            std::memset(&v, 0, sizeof(v));
+            v.view = chunks[c].view;
+            v.first_chunk = c;
+            v.hash = 0x9e3779b97f4a7c15ULL;
+            t.views.push_back(v);
+        }
+        t.views.back().nchunks++;
+        t.views.back().hash = combine(t.views.back().hash, chunks[c].hash);
+    }
+    if (!t.views.empty())
+        t.hdr.root = combine(t.hdr.root, t.views.back().hash);
+    t.hdr.nviews = (uint32_t)t.views.size();
+
+    std::string path = treePath(results);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        std::cerr << "failed to open result tree file: " << path << std::endl;
+        return false;
+    }
+    out.write((const char*)&t.hdr, sizeof(t.hdr));
+    out.write((const char*)t.views.data(), t.views.size() * sizeof(ViewNode));
+    out.write((const char*)chunks.data(), chunks.size() * sizeof(ChunkNode));
+    return out.good();
+}
+
+bool shotdigest::loadTree(const std::string& results, Tree& t) {
+    std::ifstream in(treePath(results), std::ios::binary);
+    if (!in.read((char*)&t.hdr, sizeof(t.hdr)))
+        return false;
+    if (std::memcmp(t.hdr.magic, TREE_MAGIC, sizeof(TREE_MAGIC)) != 0 || t.hdr.version != VERSION)
+        return false;
+
+    // a tree left over from an earlier run of the same name
+    std::error_code ec;
+    if (std::filesystem::file_size(results, ec) != t.hdr.file_bytes) {
+        std::cerr << "ignoring out of date result tree " << treePath(results) << std::endl;
+        return false;
+    }
+
+    t.views.resize(t.hdr.nviews);
+    t.chunks.resize(t.hdr.nchunks);
+    if (!in.read((char*)t.views.data(), t.views.size() * sizeof(ViewNode)) ||
+        !in.read((char*)t.chunks.data(), t.chunks.size() * sizeof(ChunkNode))) {
+        std::cerr << "truncated result tree " << treePath(results) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool shotdigest::differingChunks(const Tree& a, const Tree& b, std::vector<size_t>& chunks) {
+    chunks.clear();
+    if (a.hdr.tol != b.hdr.tol || a.views.size() != b.views.size() || a.chunks.size() != b.chunks.size())
+        return false;
+    for (size_t c = 0; c < a.chunks.size(); c++) {
+        if (a.chunks[c].first_ray != b.chunks[c].first_ray || a.chunks[c].nrays != b.chunks[c].nrays)
+            return false;
+    }
+
+    if (a.hdr.root == b.hdr.root)
+        return true;
+    for (size_t v = 0; v < a.views.size(); v++) {
+        const ViewNode& va = a.views[v];
+        const ViewNode& vb = b.views[v];
+        if (va.first_chunk != vb.first_chunk || va.nchunks != vb.nchunks)
+            return false;
+        if (va.hash == vb.hash)
+            continue;
+        for (uint64_t c = va.first_chunk; c < va.first_chunk + va.nchunks; c++) {
+            if (a.chunks[c].hash != b.chunks[c].hash)
+                chunks.push_back(c);
+        }
+    }
+    return true;
+}
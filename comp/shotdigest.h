@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* Per-ray digest file.
+ *
+ * The cheapest diff run output: a header, then one 16 byte record per ray
+ * holding its ray index and a 64 bit digest of the ray and its partitions.
+ * Every double is quantized to the run's tolerance before it is hashed, so
+ * two runs whose digests match agree within that tolerance (a value close
+ * to a bin edge can still land in the neighbouring bin - which is why the
+ * full shots may be kept in a detail file to settle mismatches).
+ *
+ *   FileHeader
+ *   char detail[detail_len]            detail file name, padded to 8 (may be empty)
+ *   Rec[]                              in the order the run wrote them
+ *
+ * Hit points are not hashed - they follow from the ray and hit distance.
+ */
+namespace shotdigest {
+    constexpr char FILE_MAGIC[8] = {'R', 'T', 'C', 'M', 'P', 'D', 'G', 'S'};
+    constexpr uint32_t VERSION = 1;
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t detail_len;            // bytes of detail file name following the header
+        double tol;                     // quantization step (<= 0: exact bits)
+    };
+
+    struct Rec {
+        uint64_t key;                   // ray pool index
+        uint64_t digest;
+    };
+
+    static_assert(sizeof(FileHeader) == 24, "digest file header layout");
+    static_assert(sizeof(Rec) == 16, "digest record layout");
+
+    /* file header (and detail file name) as written at the start of a digest file */
+    inline std::string fileHeader(double tol, const std::string& detail) {
+        FileHeader h;
+        std::memcpy(h.magic, FILE_MAGIC, sizeof(h.magic));
+        h.version = VERSION;
+        h.detail_len = (uint32_t)detail.size();
+        h.tol = tol;
+        std::string s((const char*)&h, sizeof(h));
+        s.append(detail);
+        s.append(((detail.size() + 7) & ~(size_t)7) - detail.size(), '\0');
+        return s;
+    }
+
+    /* fold the next value into a running hash (order matters) */
+    inline uint64_t combine(uint64_t h, uint64_t w) noexcept {
+        w *= 0x9e3779b97f4a7c15ULL;
+        w ^= w >> 32;
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        return h ^ (h >> 29);
+    }
+
+    /* does the file at path start like a digest file? */
+    bool isDigestFile(const std::string& path);
+
+    /* Contents of a digest file.  detail is resolved next to the digest
+     * file if it is not found as written */
+    struct File {
+        double tol = 0;
+        std::string detail;
+        std::vector<Rec> recs;
+    };
+    bool load(const std::string& path, File& f);
+
+    /* Running digest of one shot; fed from the writer hot path */
+    class Digest {
+    public:
+        inline void begin(const double pt[3], const double dir[3], double step) noexcept {
+            tol = step;
+            h = 0x9e3779b97f4a7c15ULL;
+            vec(pt);
+            vec(dir);
+        }
+
+        inline void partition(double indist, const double innorm[3], double outdist, const double outnorm[3],
+                              const char* region) noexcept {
+            word(quantize(indist));
+            vec(innorm);
+            word(quantize(outdist));
+            vec(outnorm);
+            // FNV-1a over the region name
+            uint64_t r = 0xcbf29ce484222325ULL;
+            for (const char* c = region; *c; c++)
+                r = (r ^ (unsigned char)*c) * 0x100000001b3ULL;
+            word(r);
+        }
+
+        inline uint64_t value() const noexcept {
+            uint64_t v = h;
+            v ^= v >> 33;
+            v *= 0xc4ceb9fe1a85ec53ULL;
+            v ^= v >> 33;
+            return v;
+        }
+
+    private:
+        /* bin index at the tolerance, or the exact bits when there is no
+         * usable step (tiny tolerances, huge values, NaN) */
+        inline uint64_t quantize(double v) const noexcept {
+            if (tol > 0) {
+                double q = std::nearbyint(v / tol);
+                if (std::fabs(q) < 9.0e18)
+                    return (uint64_t)(int64_t)q;
+            }
+            uint64_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            return bits;
+        }
+
+        inline void vec(const double v[3]) noexcept {
+            word(quantize(v[0]));
+            word(quantize(v[1]));
+            word(quantize(v[2]));
+        }
+
+        inline void word(uint64_t w) noexcept { h = combine(h, w); }
+
+        uint64_t h = 0;
+        double tol = 0;
+    };
+
+    /* Result tree of a ray ordered run, written next to its output as
+     * <output>.tree.  Each chunk hashes its shots' digests in ray order,
+     * each view its chunks and the root its views, so two runs compare
+     * top down and only chunks whose hashes differ need to be read.
+     * Chunks record where their shots sit in the output file */
+    constexpr char TREE_MAGIC[8] = {'R', 'T', 'C', 'M', 'P', 'T', 'R', 'E'};
+
+    struct TreeHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t nviews;
+        uint64_t nchunks;
+        double tol;                     // digest quantization step
+        uint64_t file_bytes;            // size of the output the tree describes
+        uint64_t root;
+    };
+
+    struct ViewNode {
+        int32_t view;                   // -1: rays not generated by view
+        uint32_t pad;
+        uint64_t first_chunk;
+        uint64_t nchunks;
+        uint64_t hash;
+    };
+
+    struct ChunkNode {
+        uint64_t first_ray;
+        uint64_t nrays;
+        uint64_t offset;                // chunk's shots in the output file
+        uint64_t bytes;
+        uint64_t hash;
+        int32_t view;
+        uint32_t pad;
+    };
+
+    static_assert(sizeof(TreeHeader) == 48, "tree header layout");
+    static_assert(sizeof(ViewNode) == 32, "tree view layout");
+    static_assert(sizeof(ChunkNode) == 48, "tree chunk layout");
+
+    struct Tree {
+        TreeHeader hdr;
+        std::vector<ViewNode> views;
+        std::vector<ChunkNode> chunks;
+    };
+
+    inline std::string treePath(const std::string& results) { return results + ".tree"; }
+
+    /* group chunks (in chunk order) into views, hash both levels and write
+     * the tree for the output file results */
+    bool writeTree(const std::string& results, double tol, const std::vector<ChunkNode>& chunks);
+
+    /* tree of the output file results; false (quietly) if there is none or
+     * it no longer matches the file */
+    bool loadTree(const std::string& results, Tree& t);
+
+    /* Walk two trees top down, collecting the chunks whose hashes differ.
+     * False if the trees do not have the same shape (different rays or
+     * chunking) or tolerance, in which case they cannot be compared */
+    bool differingChunks(const Tree& a, const Tree& b, std::vector<size_t>& chunks);
+};
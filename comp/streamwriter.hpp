@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+namespace tsj {
+
+/* get what has been written to path onto the disk (flush any stream on it first) */
+inline void syncFile(const std::string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0)
+        std::cerr << "failed to sync " << path << " to disk\n";
+    if (fd >= 0)
+        ::close(fd);
+#endif
+}
+
+/* Fixed-size output block.  Blocks are recycled through BlockPool, so their
+ * string storage is allocated once and reused for the whole run */
+struct Block {
+    std::string data;
+    uint64_t seq = 0;                       // ordered mode: chunk this block belongs to
+    uint32_t part = 0;                      // ordered mode: position within the chunk
+    bool last = false;                      // ordered mode: final block of the chunk
+    std::atomic<Block*> next{nullptr};      // MPSCQueue link
+};
+
+/* Lock-free multi-producer / single-consumer queue (intrusive, Vyukov style).
+ * push() is wait-free; pop() can return NULL while a push is still in
+ * flight, in which case the consumer just tries again */
+class MPSCQueue {
+public:
+    MPSCQueue() : head(&stub), tail(&stub) {}
+
+    void push(Block* b) noexcept {
+        b->next.store(nullptr, std::memory_order_relaxed);
+        Block* prev = head.exchange(b, std::memory_order_acq_rel);
+        prev->next.store(b, std::memory_order_release);
+    }
+
+    /* consumer side only */
+    Block* pop() noexcept {
+        Block* t = tail;
+        Block* next = t->next.load(std::memory_order_acquire);
+        if (t == &stub) {
+            if (!next)
+                return nullptr;
+            tail = next;
+            t = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail = next;
+            return t;
+        }
+        // t is the last node - only take it once the stub is queued behind it
+        if (t != head.load(std::memory_order_acquire))
+            return nullptr;
+        push(&stub);
+        next = t->next.load(std::memory_order_acquire);
+        if (next) {
+            tail = next;
+            return t;
+        }
+        return nullptr;
+    }
+private:
+    Block stub;
+    std::atomic<Block*> head;
+    Block* tail;
+};
+
+/* Bounded pool of blocks.  Blocks are created on demand up to max_blocks;
+ * after that acquire() waits for the writer thread to hand one back, which
+ * is what keeps a run under its memory ceiling */
+class BlockPool {
+public:
+    void init(size_t block_bytes, size_t max_blocks) {
+        std::lock_guard<std::mutex> lock(p_mtx);
+        p_block_bytes = block_bytes;
+        p_max_blocks = max_blocks;
+    }
+
+    Block* acquire() {
+        return acquire([] { return false; });
+    }
+
+    /* urgent() lets a caller grow the pool past max_blocks when waiting could
+     * never be satisfied (see StreamWriter ordered mode) */
+    template <typename Pred>
+    Block* acquire(Pred urgent) {
+        std::unique_lock<std::mutex> lock(p_mtx);
+        if (p_free.empty() && p_owned.size() >= p_max_blocks)
+            p_cv.wait(lock, [&] { return !p_free.empty() || urgent(); });
+        if (p_free.empty()) {
+            p_owned.emplace_back(new Block);
+            p_owned.back()->data.reserve(p_block_bytes);
+            return p_owned.back().get();
+        }
+        Block* b = p_free.back();
+        p_free.pop_back();
+        return b;
+    }
+
+    void release(Block* b) {
+        b->data.clear();
+        {
+            std::lock_guard<std::mutex> lock(p_mtx);
+            p_free.push_back(b);
+        }
+        p_cv.notify_one();
+    }
+
+    /* re-check waiters after something other than a release changed */
+    void wake() {
+        { std::lock_guard<std::mutex> lock(p_mtx); }
+        p_cv.notify_all();
+    }
+
+    /* free every block - only once nothing is in flight */
+    void clear() {
+        std::lock_guard<std::mutex> lock(p_mtx);
+        p_free.clear();
+        p_owned.clear();
+    }
+private:
+    std::mutex p_mtx;
+    std::condition_variable p_cv;
+    std::vector<std::unique_ptr<Block>> p_owned;
+    std::vector<Block*> p_free;
+    size_t p_block_bytes = 0;
+    size_t p_max_blocks = 0;
+};
+
+/* Streams submitted blocks to disk from a background thread while the run
+ * is still going, so peak memory is bounded by the pool instead of the
+ * size of the output file.
+ *
+ * In ordered mode every block is tagged with the chunk it holds and the
+ * writer merges them back into chunk order, so the file does not depend
+ * on thread count or scheduling.  Producers must hand out chunks in
+ * increasing order (and submit each chunk's last block even when empty) */
+class StreamWriter {
+public:
+    static constexpr size_t DEFAULT_BLOCK_BYTES = 4 * 1024 * 1024;
+
+    /* open path for writing, starting with header; max_bytes caps the memory
+     * held in blocks (0 picks a couple of blocks per producer).  Every producer needs a block of its
+     * own plus one in flight, so the ceiling is raised to that if needed */
+    bool open(const std::string& path, size_t max_bytes, size_t nproducers, bool ordered = false, const std::string& header = std::string()) {
+        // "-" is standard output
+        std::string file = path;
+        if (path == "-") {
+#ifdef _WIN32
+            std::cerr << "cannot write output to stdout on this platform, use a named pipe" << std::endl;
+            return false;
+#else
+            file = "/dev/stdout";
+#endif
+        }
+        p_out.open(file, std::ios::binary | std::ios::trunc);
+        if (!p_out.is_open()) {
+            std::cerr << "failed to open output file: " << path << std::endl;
+            return false;
+        }
+        p_out.write(header.data(), header.size());
+        p_path = path;
+        p_start(header.size(), max_bytes, nproducers, ordered, 0);
+        return true;
+    }
+
+    /* ordered mode: carry on with a file where a checkpoint left it - keep
+     * its first bytes (header included), drop the rest and continue with
+     * chunk first_seq */
+    bool resume(const std::string& path, size_t max_bytes, size_t nproducers, uint64_t bytes, uint64_t first_seq) {
+        std::error_code ec;
+        if (std::filesystem::file_size(path, ec) < bytes || ec) {
+            std::cerr << "cannot resume " << path << ": it is shorter than its checkpoint" << std::endl;
+            return false;
+        }
+        std::filesystem::resize_file(path, bytes, ec);
+        if (!ec)
+            p_out.open(path, std::ios::binary | std::ios::app);
+        if (ec || !p_out.is_open()) {
+            std::cerr << "failed to reopen output file: " << path << std::endl;
+            return false;
+        }
+        p_path = path;
+        p_start(bytes, max_bytes, nproducers, true, first_seq);
+        return true;
+    }
+
+    /* ordered mode: every `seconds`, once a chunk is done, flush and sync
+     * the file to disk and then call on_sync (from the writer thread).  Set
+     * before open(); seconds <= 0 turns it off */
+    void setSync(double seconds, std::function<void()> on_sync) {
+        p_sync_seconds = seconds;
+        p_on_sync = std::move(on_sync);
+    }
+
+    /* ordered mode: chunks (counted from 0) known to be on disk */
+    uint64_t syncedChunks() {
+        std::lock_guard<std::mutex> lock(p_sync_mtx);
+        return p_synced_seq;
+    }
+
+    /* ordered mode: file offset where chunk seq starts (for seq from the
+     * first chunk of this open() through one past the last finished) */
+    uint64_t chunkStart(uint64_t seq) {
+        std::lock_guard<std::mutex> lock(p_sync_mtx);
+        return p_chunk_offsets.at(seq - p_first_seq);
+    }
+
+    /* blocks are handed back full (or at the end of a producer's work) */
+    Block* acquire() { return p_pool.acquire(); }
+    void submit(Block* b) { p_queue.push(b); }
+
+    /* ordered mode: block for chunk seq.  Blocks parked for later chunks can
+     * use up the pool, so the chunk the writer is waiting on may always grow
+     * it - otherwise that producer and the writer would wait on each other */
+    Block* acquire(uint64_t seq) {
+        return p_pool.acquire([this, seq] {
+            return seq == p_next_seq.load(std::memory_order_acquire);
+        });
+    }
+
+    /* bytes a producer may fill before handing a block off */
+    size_t blockBytes() const noexcept { return p_block_bytes; }
+
+    /* ordered mode, after close(): file offset of each chunk's first byte
+     * (from the first chunk of this open()), followed by the end of the
+     * last chunk */
+    const std::vector<uint64_t>& chunkOffsets() const noexcept { return p_chunk_offsets; }
+
+    /* drain everything that was submitted, end the file with trailer and close it */
+    void close(const std::string& trailer = std::string()) {
+        if (!p_thread.joinable())
+            return;
+        p_done.store(true, std::memory_order_release);
+        p_thread.join();
+        p_out.write(trailer.data(), trailer.size());
+        p_out.close();
+        p_pool.clear();
+    }
+private:
+    /* writer state for a file whose first `written` bytes are out already */
+    void p_start(uint64_t written, size_t max_bytes, size_t nproducers, bool ordered, uint64_t first_seq) {
+        p_written = written;
+        p_chunk_offsets.assign(1, written);
+
+        size_t block_bytes = DEFAULT_BLOCK_BYTES;
+        size_t min_blocks = nproducers + 1;
+        size_t max_blocks = (max_bytes) ? max_bytes / block_bytes : 2 * nproducers + 2;
+        if (max_bytes && max_blocks < min_blocks) {
+            // small ceilings: shrink the blocks before exceeding the ceiling
+            block_bytes = std::max<size_t>(max_bytes / min_blocks, 64 * 1024);
+            max_blocks = std::max<size_t>(max_bytes / block_bytes, min_blocks);
+            if (max_blocks * block_bytes > max_bytes)
+                std::cerr << "output memory limit raised to " << max_blocks * block_bytes << " bytes (" << min_blocks << " blocks minimum)\n";
+        }
+        p_block_bytes = block_bytes;
+        p_pool.init(block_bytes, max_blocks);
+
+        p_ordered = ordered;
+        p_next_seq.store(first_seq);
+        p_next_part = 0;
+        p_first_seq = first_seq;
+        p_synced_seq = first_seq;
+        p_last_sync = std::chrono::steady_clock::now();
+
+        p_done.store(false);
+        p_thread = std::thread(&StreamWriter::p_run, this);
+    }
+
+    void p_run() {
+        while (true) {
+            Block* b = p_queue.pop();
+            if (b) {
+                p_write(b);
+                continue;
+            }
+            // producers are finished before close() is called, so once the
+            // flag is up an empty queue really is empty
+            if (p_done.load(std::memory_order_acquire)) {
+                while ((b = p_queue.pop()))
+                    p_write(b);
+                // anything still parked means a chunk never finished; keep
+                // the data rather than dropping it
+                if (!p_pending.empty())
+                    std::cerr << "ordered output: " << p_pending.size() << " blocks written out of order\n";
+                for (auto& [key, pb] : p_pending) {
+                    p_out.write(pb->data.data(), pb->data.size());
+                    p_written += pb->data.size();
+                    p_pool.release(pb);
+                }
+                p_pending.clear();
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        p_out.flush();
+    }
+
+    /* write b, or park it until every block ahead of it has been written */
+    void p_write(Block* b) {
+        if (!p_ordered) {
+            p_out.write(b->data.data(), b->data.size());
+            p_written += b->data.size();
+            p_pool.release(b);
+            return;
+        }
+
+        p_pending.emplace(std::make_pair(b->seq, b->part), b);
+        auto it = p_pending.begin();
+        while (it != p_pending.end() && it->first == std::make_pair(p_next_seq.load(std::memory_order_relaxed), p_next_part)) {
+            Block* nb = it->second;
+            bool last = nb->last;
+            p_out.write(nb->data.data(), nb->data.size());
+            p_written += nb->data.size();
+            p_pool.release(nb);
+            it = p_pending.erase(it);
+
+            if (last) {
+                p_next_seq.fetch_add(1, std::memory_order_release);
+                p_next_part = 0;
+                p_pool.wake();
+                {
+                    std::lock_guard<std::mutex> lock(p_sync_mtx);
+                    p_chunk_offsets.push_back(p_written);
+                }
+                if (p_sync_seconds > 0 && std::chrono::steady_clock::now() - p_last_sync >= std::chrono::duration<double>(p_sync_seconds))
+                    p_sync();
+            } else {
+                p_next_part++;
+            }
+        }
+    }
+
+    /* make everything up to the current chunk durable, then report it */
+    void p_sync() {
+        p_out.flush();
+        syncFile(p_path);
+        {
+            std::lock_guard<std::mutex> lock(p_sync_mtx);
+            p_synced_seq = p_next_seq.load(std::memory_order_relaxed);
+        }
+        p_last_sync = std::chrono::steady_clock::now();
+        if (p_on_sync)
+            p_on_sync();
+    }
+
+    std::ofstream p_out;
+    std::string p_path;
+    std::thread p_thread;
+    std::atomic<bool> p_done{false};
+    MPSCQueue p_queue;
+    BlockPool p_pool;
+    size_t p_block_bytes = DEFAULT_BLOCK_BYTES;
+    uint64_t p_written = 0;                 // bytes written so far (writer thread)
+
+    // ordered mode merge state (writer thread only, except p_next_seq)
+    bool p_ordered = false;
+    std::atomic<uint64_t> p_next_seq{0};
+    uint32_t p_next_part = 0;
+    std::map<std::pair<uint64_t, uint32_t>, Block*> p_pending;
+    uint64_t p_first_seq = 0;               // chunk the file continues with (resume())
+
+    // ordered mode checkpointing (p_sync_mtx guards the shared part)
+    std::mutex p_sync_mtx;
+    std::vector<uint64_t> p_chunk_offsets;  // start of each chunk from p_first_seq, then the end of the last done
+    uint64_t p_synced_seq = 0;
+    double p_sync_seconds = 0;
+    std::function<void()> p_on_sync;
+    std::chrono::steady_clock::time_point p_last_sync;
+};
+
+} // namespace tsj
@@ -66,7 +66,7 @@ dry_getbox(void *UNUSED(g), point_t *UNUSED(min), point_t *UNUSED(max))
 }
 
 void           *
-dry_constructor(const char *UNUSED(file), int UNUSED(numreg), const char **UNUSED(regs))
+dry_constructor(const char *UNUSED(file), int UNUSED(numreg), const char **UNUSED(regs), const AppConfig &UNUSED(acfg))
 {
     return (void *) 1;
 }
@@ -27,8 +27,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#if defined(__linux__)
+#  include <unistd.h>
+#endif
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <map>
+#include <vector>
 
 #include <brlcad/bu.h>
 
@@ -118,6 +125,11 @@ typedef struct {
     double rays_per_sec_wall;
     double rays_per_sec_cpu;
     double pool_reuse;
+
+    /* sampled per-ray latency (microseconds) */
+    double latency_p50;
+    double latency_p90;
+    double latency_p99;
 } perf_results_t;
 
 typedef struct {
@@ -132,6 +144,31 @@ typedef struct {
     void (*shoot) (void *, struct xray * ray);
 } perf_run_bundle_t;
 
+/* resident set size of this process in bytes, 0 where we can't tell */
+static size_t
+rss_bytes()
+{
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0, resident_pages = 0;
+    if (statm >> total_pages >> resident_pages)
+	return resident_pages * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    return 0;
+}
+
+/* nearest-rank percentile; reorders samples */
+static double
+percentile(std::vector<double>& samples, double pct)
+{
+    if (samples.empty())
+	return 0.0;
+
+    size_t rank = (size_t)(pct / 100.0 * (samples.size() - 1) + 0.5);
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
 perf_results_t do_perf(perf_run_bundle_t params) {
     /* create rays array (MUST FREE) */
     struct xray* rays = NULL;
@@ -150,11 +187,23 @@ perf_results_t do_perf(perf_run_bundle_t params) {
     if (check_interval < 1) check_interval = 1;
     if (check_interval > 100000) check_interval = 100000;
 
+    /* only time every n-th ray so the timer calls don't skew throughput */
+    const size_t LATENCY_SAMPLE_STRIDE = 64;
+    std::vector<double> latency_usec;
+    latency_usec.reserve(num_rays / LATENCY_SAMPLE_STRIDE + 1);
+
     /* performance run */
     wallclock_start = bu_gettime(); cpu_start = clock();
     do {
 	for (size_t i = 0; i < check_interval; ++i) {
-	    params.shoot(params.inst, &rays[ray_index]);
+	    if (rays_shot % LATENCY_SAMPLE_STRIDE == 0) {
+		auto shot_start = std::chrono::steady_clock::now();
+		params.shoot(params.inst, &rays[ray_index]);
+		auto shot_end = std::chrono::steady_clock::now();
+		latency_usec.push_back(std::chrono::duration<double, std::micro>(shot_end - shot_start).count());
+	    } else {
+		params.shoot(params.inst, &rays[ray_index]);
+	    }
 	    ++rays_shot;
 
 	    ++ray_index;
@@ -173,17 +222,21 @@ perf_results_t do_perf(perf_run_bundle_t params) {
     double rays_per_sec_wall = rays_shot / wall_sec;
     double rays_per_sec_cpu = rays_shot / cpu_sec;
     double pool_reuse = (double)rays_shot / (double)num_rays;
+    double p50 = percentile(latency_usec, 50.0);
+    double p90 = percentile(latency_usec, 90.0);
+    double p99 = percentile(latency_usec, 99.0);
 
-    return {wall_sec, cpu_sec, rays_shot, num_rays, rays_per_sec_wall, rays_per_sec_cpu, pool_reuse};
+    return {wall_sec, cpu_sec, rays_shot, num_rays, rays_per_sec_wall, rays_per_sec_cpu, pool_reuse, p50, p90, p99};
 }
 
 void
 do_perf_run(const char *prefix, int argc, const char **argv, int nthreads, double perf_seconds, size_t max_ray_pool_bytes,
-	void *(*constructor) (const char *, int, const char **),
+	void *(*constructor) (const char *, int, const char **, const AppConfig&),
 	int (*getbox) (void *, point_t *, point_t *),
 	double (*getsize) (void *),
 	void (*shoot) (void *, struct xray * ray),
-	int (*destructor) (void *))
+	int (*destructor) (void *),
+	const AppConfig& acfg)
 {
     void *inst;
 
@@ -201,7 +254,7 @@ do_perf_run(const char *prefix, int argc, const char **argv, int nthreads, doubl
     if (perf_seconds <= 0.0)
 	perf_seconds = 1.0;
 
-    inst = constructor(*argv, argc-1, argv+1);
+    inst = constructor(*argv, argc-1, argv+1, acfg);
     if (inst == NULL) {
 	return;
     }
@@ -262,8 +315,490 @@ do_perf_run(const char *prefix, int argc, const char **argv, int nthreads, doubl
     std::cout << std::fixed << std::setprecision(2) << "Rays shot       (" << prefix << "): " << main_res.rays_shot << "\n";
     std::cout << std::fixed << std::setprecision(2) << "Ray pool size   (" << prefix << "): " << main_res.pool_size << "\n";
     std::cout << std::fixed << std::setprecision(2) << "Pool reuse      (" << prefix << "): " << main_res.pool_reuse << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Ray latency p50 (" << prefix << "): " << main_res.latency_p50 << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Ray latency p90 (" << prefix << "): " << main_res.latency_p90 << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Ray latency p99 (" << prefix << "): " << main_res.latency_p99 << "\n";
+    if (acfg.onehit > 0)
+	std::cout << "Onehit          (" << prefix << "): " << acfg.onehit << "\n";
+    if (acfg.max_dist > 0.0)
+	std::cout << std::fixed << std::setprecision(2) << "Max distance    (" << prefix << "): " << acfg.max_dist << "\n";
+}
+
+/* shoot each ray once, recording how long each one took (microseconds).
+ * returns the summed time for the set */
+static double
+time_rays(void *inst, void (*shoot) (void *, struct xray * ray), struct xray *rays, size_t nrays, double *usec)
+{
+    double total = 0.0;
+    for (size_t i = 0; i < nrays; ++i) {
+	auto shot_start = std::chrono::steady_clock::now();
+	shoot(inst, &rays[i]);
+	auto shot_end = std::chrono::steady_clock::now();
+	usec[i] = std::chrono::duration<double, std::micro>(shot_end - shot_start).count();
+	total += usec[i];
+    }
+    return total;
+}
+
+void
+do_bool_perf_run(const char *prefix, int argc, const char **argv, double perf_seconds, size_t max_ray_pool_bytes,
+	void *(*constructor) (const char *, int, const char **, const AppConfig&),
+	int (*getbox) (void *, point_t *, point_t *),
+	double (*getsize) (void *),
+	void (*shoot) (void *, struct xray * ray),
+	void (*configure) (void *, const AppConfig&),
+	int (*destructor) (void *),
+	const AppConfig& acfg)
+{
+    double radius;
+    point_t bb[3];	/* bounding box, third is center */
+    vect_t dir[NUMVIEWS] = {
+	{0,0,1}, {0,1,0}, {1,0,0},	/* axis */
+	{1,1,1}, {1,4,-1}, {-1,-2,4}	/* non-axis */
+    };
+    for(int i=0;i<NUMVIEWS;i++) VUNITIZE(dir[i]); /* normalize the dirs */
+
+    if (perf_seconds <= 0.0)
+	perf_seconds = 1.0;
+
+    void *inst = constructor(*argv, argc-1, argv+1, acfg);
+    if (inst == NULL) {
+	return;
+    }
+    radius = getsize(inst);
+    getbox(inst, bb, bb+1);
+    VADD2SCALE(bb[2], *bb, bb[1], 0.5);
+
+    /* size the pool from a short seed run - the warm-up and both timed
+     * passes share the time budget */
+    const double SEED_SECONDS = 0.25;
+    const size_t SEED_TARGET_RAYS = 100000;
+    perf_run_bundle_t seed_bundle = {SEED_SECONDS, SEED_TARGET_RAYS, max_ray_pool_bytes, radius, bb, dir, inst, shoot};
+    perf_results_t seed_res = do_perf(seed_bundle);
+    size_t target_rays = (size_t)(seed_res.rays_per_sec_wall * perf_seconds / 3.0);
+
+    struct xray *rays = NULL;
+    size_t num_rays = make_perf_rays(&rays, radius, bb[2], dir, target_rays, max_ray_pool_bytes);
+    if (!rays || num_rays == 0) {
+	destructor(inst);
+	return;
+    }
+    size_t rays_per_view = num_rays / NUMVIEWS;
+
+    /* the same prepped rt_i shoots every view twice: once with full boolean
+     * evaluation and once returning raw segments.  Whatever the raw pass
+     * doesn't spend is the cost of weaving.  An untimed pass warms the
+     * caches for the view first, and the timed passes take turns going
+     * first, so neither is always measured on the other's warm caches */
+    AppConfig raw_cfg = acfg;
+    raw_cfg.no_booleans = 1;
+
+    std::vector<double> full_usec(num_rays), raw_usec(num_rays);
+    double full_total[NUMVIEWS], raw_total[NUMVIEWS];
+    for (int j = 0; j < NUMVIEWS; ++j) {
+	size_t first = j * rays_per_view;
+
+	configure(inst, acfg);
+	for (size_t i = 0; i < rays_per_view; ++i)
+	    shoot(inst, &rays[first + i]);
+
+	for (int pass = 0; pass < 2; ++pass) {
+	    if ((pass + j) % 2 == 0) {
+		configure(inst, acfg);
+		full_total[j] = time_rays(inst, shoot, rays + first, rays_per_view, &full_usec[first]);
+	    } else {
+		configure(inst, raw_cfg);
+		raw_total[j] = time_rays(inst, shoot, rays + first, rays_per_view, &raw_usec[first]);
+	    }
+	}
+    }
+    configure(inst, acfg);
+
+    bu_free(rays, "bool ray pool free");
+    destructor(inst);
+
+    /* per-ray weaving share of the full shot cost */
+    std::vector<double> share(num_rays);
+    for (size_t i = 0; i < num_rays; ++i)
+	share[i] = (full_usec[i] > 0.0) ? (full_usec[i] - raw_usec[i]) / full_usec[i] * 100.0 : 0.0;
+
+    /* Report */
+    std::cout << "Boolean weaving cost (" << prefix << "), " << rays_per_view << " rays per view\n";
+    std::cout << "  view     full [s]      raw [s]  weave [%]  ray p50 [%]  ray p90 [%]\n";
+    double full_sum = 0.0, raw_sum = 0.0;
+    for (int j = 0; j < NUMVIEWS; ++j) {
+	std::vector<double> view_share(share.begin() + j * rays_per_view, share.begin() + (j + 1) * rays_per_view);
+	double view_pct = (full_total[j] > 0.0) ? (full_total[j] - raw_total[j]) / full_total[j] * 100.0 : 0.0;
+	std::cout << std::fixed << std::setprecision(4)
+		  << "  " << std::setw(4) << j
+		  << std::setw(13) << full_total[j] / 1000000.0
+		  << std::setw(13) << raw_total[j] / 1000000.0
+		  << std::setprecision(2)
+		  << std::setw(11) << view_pct
+		  << std::setw(13) << percentile(view_share, 50.0)
+		  << std::setw(13) << percentile(view_share, 90.0) << "\n";
+	full_sum += full_total[j];
+	raw_sum += raw_total[j];
+    }
+
+    double weave_pct = (full_sum > 0.0) ? (full_sum - raw_sum) / full_sum * 100.0 : 0.0;
+    std::cout << std::fixed << std::setprecision(2) << "Rays/sec [full] (" << prefix << "): " << num_rays / (full_sum / 1000000.0) << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Rays/sec [raw]  (" << prefix << "): " << num_rays / (raw_sum / 1000000.0) << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Weave share [%] (" << prefix << "): " << weave_pct << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Weave ray p50   (" << prefix << "): " << percentile(share, 50.0) << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Weave ray p90   (" << prefix << "): " << percentile(share, 90.0) << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Weave ray p99   (" << prefix << "): " << percentile(share, 99.0) << "\n";
+}
+
+
+void
+do_hit_level_perf_run(const char *prefix, int argc, const char **argv, double perf_seconds, size_t max_ray_pool_bytes,
+	void *(*constructor) (const char *, int, const char **, const AppConfig&),
+	int (*getbox) (void *, point_t *, point_t *),
+	double (*getsize) (void *),
+	void (*shoot) (void *, struct xray * ray),
+	void (*configure) (void *, const AppConfig&),
+	int (*destructor) (void *),
+	const AppConfig& acfg)
+{
+    static const char *level_names[HIT_LEVEL_CNT] = {"traversal", "normals", "curvature", "uv"};
+    double radius;
+    point_t bb[3];	/* bounding box, third is center */
+    vect_t dir[NUMVIEWS] = {
+	{0,0,1}, {0,1,0}, {1,0,0},	/* axis */
+	{1,1,1}, {1,4,-1}, {-1,-2,4}	/* non-axis */
+    };
+    for(int i=0;i<NUMVIEWS;i++) VUNITIZE(dir[i]); /* normalize the dirs */
+
+    if (perf_seconds <= 0.0)
+	perf_seconds = 1.0;
+
+    void *inst = constructor(*argv, argc-1, argv+1, acfg);
+    if (inst == NULL) {
+	return;
+    }
+    radius = getsize(inst);
+    getbox(inst, bb, bb+1);
+    VADD2SCALE(bb[2], *bb, bb[1], 0.5);
+
+    /* size the pool once from the cheapest level so every level shoots the same rays */
+    AppConfig level_cfg = acfg;
+    level_cfg.hit_level = HIT_TRAVERSAL;
+    configure(inst, level_cfg);
+
+    const double SEED_SECONDS = 0.25;
+    const size_t SEED_TARGET_RAYS = 100000;
+    perf_run_bundle_t seed_bundle = {SEED_SECONDS, SEED_TARGET_RAYS, max_ray_pool_bytes, radius, bb, dir, inst, shoot};
+    perf_results_t seed_res = do_perf(seed_bundle);
+    size_t target_rays = (size_t)(seed_res.rays_per_sec_wall * perf_seconds);
+
+    /* each level runs on the same prepped geometry for perf_seconds */
+    perf_results_t level_res[HIT_LEVEL_CNT];
+    for (int level = HIT_TRAVERSAL; level < HIT_LEVEL_CNT; ++level) {
+	level_cfg.hit_level = level;
+	configure(inst, level_cfg);
+
+	perf_run_bundle_t bundle = {perf_seconds, target_rays, max_ray_pool_bytes, radius, bb, dir, inst, shoot};
+	level_res[level] = do_perf(bundle);
+    }
+    configure(inst, acfg);
+
+    destructor(inst);
+
+    /* Report - cost of each level is relative to the one below it */
+    std::cout << "Hit processing levels (" << prefix << ")\n";
+    std::cout << "  level            rays/sec   usec/ray   +usec/ray\n";
+    for (int level = HIT_TRAVERSAL; level < HIT_LEVEL_CNT; ++level) {
+	double rps = level_res[level].rays_per_sec_wall;
+	double usec = (rps > 0.0) ? 1000000.0 / rps : 0.0;
+	double prev_rps = (level > HIT_TRAVERSAL) ? level_res[level - 1].rays_per_sec_wall : rps;
+	double prev_usec = (prev_rps > 0.0) ? 1000000.0 / prev_rps : 0.0;
+	std::cout << std::fixed << std::setprecision(2)
+		  << "  " << std::left << std::setw(10) << level_names[level] << std::right
+		  << std::setw(15) << rps
+		  << std::setprecision(4)
+		  << std::setw(11) << usec
+		  << std::setw(12) << usec - prev_usec << "\n";
+    }
+    for (int level = HIT_TRAVERSAL; level < HIT_LEVEL_CNT; ++level) {
+	std::cout << std::fixed << std::setprecision(2) << "Rays/sec [L" << level << "]   (" << prefix << "): " << level_res[level].rays_per_sec_wall << "\n";
+    }
 }
 
+void
+do_mintie_sweep_run(const char *prefix, int argc, const char **argv, double perf_seconds, size_t max_ray_pool_bytes,
+	const std::vector<int>& mintie_vals,
+	void *(*constructor) (const char *, int, const char **, const AppConfig&),
+	int (*getbox) (void *, point_t *, point_t *),
+	double (*getsize) (void *),
+	void (*shoot) (void *, struct xray * ray),
+	int (*destructor) (void *),
+	const AppConfig& acfg)
+{
+    struct mintie_res {
+	int mintie;
+	double prep_sec;
+	double mem_mb;
+	perf_results_t perf;
+    };
+    std::vector<mintie_res> results;
+
+    double radius = -1.0;
+    point_t bb[3];	/* bounding box, third is center */
+    vect_t dir[NUMVIEWS] = {
+	{0,0,1}, {0,1,0}, {1,0,0},	/* axis */
+	{1,1,1}, {1,4,-1}, {-1,-2,4}	/* non-axis */
+    };
+    for(int i=0;i<NUMVIEWS;i++) VUNITIZE(dir[i]); /* normalize the dirs */
+
+    if (perf_seconds <= 0.0)
+	perf_seconds = 1.0;
+
+    /* re-prep the object from scratch at every threshold */
+    for (int mintie : mintie_vals) {
+	AppConfig sweep_cfg = acfg;
+	sweep_cfg.bot_mintie = mintie;
+
+	/* NOTE: memory is the resident growth across prep, so it is only
+	 * approximate once earlier preps have given pages back to the allocator */
+	size_t rss_start = rss_bytes();
+	int64_t prep_start = bu_gettime();
+	void *inst = constructor(*argv, argc-1, argv+1, sweep_cfg);
+	int64_t prep_end = bu_gettime();
+	size_t rss_end = rss_bytes();
+	if (inst == NULL) {
+	    return;
+	}
+
+	/* geometry doesn't change between preps - first one defines the views */
+	if (radius < 0.0) {
+	    radius = getsize(inst);
+	    getbox(inst, bb, bb+1);
+	    VADD2SCALE(bb[2], *bb, bb[1], 0.5);
+	}
+
+	const double SEED_SECONDS = 0.25;
+	const size_t SEED_TARGET_RAYS = 100000;
+	perf_run_bundle_t seed_bundle = {SEED_SECONDS, SEED_TARGET_RAYS, max_ray_pool_bytes, radius, bb, dir, inst, shoot};
+	perf_results_t seed_res = do_perf(seed_bundle);
+
+	perf_run_bundle_t main_bundle = {perf_seconds, (size_t)(seed_res.rays_per_sec_wall * perf_seconds), max_ray_pool_bytes, radius, bb, dir, inst, shoot};
+	perf_results_t main_res = do_perf(main_bundle);
+
+	destructor(inst);
+
+	double mem_mb = (rss_end > rss_start) ? (rss_end - rss_start) / (1024.0 * 1024.0) : 0.0;
+	results.push_back({mintie, (prep_end - prep_start) / 1000000.0, mem_mb, main_res});
+    }
+
+    if (results.empty())
+	return;
+
+    /* suggest the fastest threshold; anything within a couple percent of it
+     * is noise, so among those take the one that used the least memory */
+    const double NOISE_FRACTION = 0.02;
+    double best_rps = 0.0;
+    for (auto &r : results)
+	best_rps = std::max(best_rps, r.perf.rays_per_sec_wall);
+    const mintie_res *best = NULL;
+    for (auto &r : results) {
+	if (r.perf.rays_per_sec_wall < best_rps * (1.0 - NOISE_FRACTION))
+	    continue;
+	if (!best || r.mem_mb < best->mem_mb)
+	    best = &r;
+    }
+
+    /* Report */
+    std::cout << "LIBRT_BOT_MINTIE sweep (" << prefix << ")\n";
+    std::cout << "      mintie    prep [s]    mem [MB]       rays/sec\n";
+    for (auto &r : results) {
+	std::cout << std::fixed << std::setprecision(2)
+		  << "  " << std::setw(10) << r.mintie
+		  << std::setw(12) << r.prep_sec
+		  << std::setw(12) << r.mem_mb
+		  << std::setw(15) << r.perf.rays_per_sec_wall
+		  << ((&r == best) ? "  <- best" : "") << "\n";
+    }
+    std::cout << "Suggested LIBRT_BOT_MINTIE (" << prefix << "): " << best->mintie << "\n";
+}
+
+void
+do_bot_tune_run(const char *prefix, int argc, const char **argv, double perf_seconds, size_t max_ray_pool_bytes,
+	const std::string& search,
+	void *(*constructor) (const char *, int, const char **, const AppConfig&),
+	int (*getbox) (void *, point_t *, point_t *),
+	double (*getsize) (void *),
+	void (*shoot) (void *, struct xray * ray),
+	int (*destructor) (void *),
+	const AppConfig& acfg)
+{
+    /* candidate values - -1 keeps the librt default so the baseline is always
+     * measured, a minpieces of 0 keeps every BoT in one piece */
+    static const std::vector<int> minpieces_cand = {-1, 0, 8, 16, 32, 64, 128};
+    static const std::vector<int> tri_cand       = {-1, 1, 2, 4, 8, 16, 32};
+    const int MAX_DESCENT_PASSES = 3;
+
+    struct bot_res {
+	int minpieces;
+	int tri_per_piece;
+	double prep_sec;
+	double mem_mb;
+	double rays_per_sec;
+    };
+    std::map<std::pair<int, int>, bot_res> results;
+
+    double radius = -1.0;
+    point_t bb[3];	/* bounding box, third is center */
+    vect_t dir[NUMVIEWS] = {
+	{0,0,1}, {0,1,0}, {1,0,0},	/* axis */
+	{1,1,1}, {1,4,-1}, {-1,-2,4}	/* non-axis */
+    };
+    for(int i=0;i<NUMVIEWS;i++) VUNITIZE(dir[i]); /* normalize the dirs */
+
+    if (search != "grid" && search != "descent") {
+	std::cerr << "Unknown BoT tuning search '" << search << "' (expected grid or descent)\n";
+	return;
+    }
+
+    /* every trial shoots the same fixed pool once, so trials compare equal work */
+    struct xray *rays = NULL;
+    size_t num_rays = 0;
+
+    auto trial = [&](int minpieces, int tri_per_piece) -> const bot_res * {
+	auto key = std::make_pair(minpieces, tri_per_piece);
+	auto found = results.find(key);
+	if (found != results.end())
+	    return &found->second;
+
+	AppConfig trial_cfg = acfg;
+	trial_cfg.bot_minpieces = minpieces;
+	trial_cfg.bot_tri_per_piece = tri_per_piece;
+
+	size_t rss_start = rss_bytes();
+	int64_t prep_start = bu_gettime();
+	void *inst = constructor(*argv, argc-1, argv+1, trial_cfg);
+	int64_t prep_end = bu_gettime();
+	size_t rss_end = rss_bytes();
+	if (inst == NULL)
+	    return NULL;
+
+	/* first prep defines the views and sizes the fixed-work pool */
+	if (!rays) {
+	    radius = getsize(inst);
+	    getbox(inst, bb, bb+1);
+	    VADD2SCALE(bb[2], *bb, bb[1], 0.5);
+
+	    size_t trial_cnt = (search == "grid") ? minpieces_cand.size() * tri_cand.size() : (minpieces_cand.size() + tri_cand.size()) * 2;
+	    double trial_seconds = std::max(perf_seconds / trial_cnt, 0.25);
+	    const double SEED_SECONDS = 0.25;
+	    const size_t SEED_TARGET_RAYS = 100000;
+	    perf_run_bundle_t seed_bundle = {SEED_SECONDS, SEED_TARGET_RAYS, max_ray_pool_bytes, radius, bb, dir, inst, shoot};
+	    perf_results_t seed_res = do_perf(seed_bundle);
+	    num_rays = make_perf_rays(&rays, radius, bb[2], dir, (size_t)(seed_res.rays_per_sec_wall * trial_seconds), max_ray_pool_bytes);
+	}
+
+	int64_t shoot_start = bu_gettime();
+	for (size_t i = 0; i < num_rays; ++i)
+	    shoot(inst, &rays[i]);
+	int64_t shoot_end = bu_gettime();
+
+	destructor(inst);
+
+	double shoot_sec = (shoot_end - shoot_start) / 1000000.0;
+	bot_res r = {
+	    minpieces, tri_per_piece,
+	    (prep_end - prep_start) / 1000000.0,
+	    (rss_end > rss_start) ? (rss_end - rss_start) / (1024.0 * 1024.0) : 0.0,
+	    (shoot_sec > 0.0) ? num_rays / shoot_sec : 0.0
+	};
+	return &results.emplace(key, r).first->second;
+    };
+
+    /* a failed prep stops the search; whatever was measured is still reported */
+    auto run_search = [&]() {
+	if (search == "grid") {
+	    for (int minpieces : minpieces_cand)
+		for (int tri_per_piece : tri_cand)
+		    if (!trial(minpieces, tri_per_piece))
+			return;
+	    return;
+	}
+
+	/* coordinate descent on throughput, starting from the librt defaults */
+	const bot_res *cur = trial(-1, -1);
+	if (!cur)
+	    return;
+	for (int pass = 0; pass < MAX_DESCENT_PASSES; ++pass) {
+	    bool improved = false;
+	    for (int minpieces : minpieces_cand) {
+		const bot_res *r = trial(minpieces, cur->tri_per_piece);
+		if (!r)
+		    return;
+		if (r->rays_per_sec > cur->rays_per_sec) {
+		    cur = r;
+		    improved = true;
+		}
+	    }
+	    for (int tri_per_piece : tri_cand) {
+		const bot_res *r = trial(cur->minpieces, tri_per_piece);
+		if (!r)
+		    return;
+		if (r->rays_per_sec > cur->rays_per_sec) {
+		    cur = r;
+		    improved = true;
+		}
+	    }
+	    if (!improved)
+		return;
+	}
+    };
+    run_search();
+
+    if (rays)
+	bu_free(rays, "bot tune ray pool free");
+    if (results.empty())
+	return;
+
+    /* Pareto front - keep a setting unless another is at least as good on
+     * prep time, memory and throughput, and strictly better on one */
+    std::vector<const bot_res *> front;
+    for (auto &[key, a] : results) {
+	bool dominated = false;
+	for (auto &[okey, b] : results) {
+	    if (&a == &b)
+		continue;
+	    bool no_worse = b.prep_sec <= a.prep_sec && b.mem_mb <= a.mem_mb && b.rays_per_sec >= a.rays_per_sec;
+	    bool better = b.prep_sec < a.prep_sec || b.mem_mb < a.mem_mb || b.rays_per_sec > a.rays_per_sec;
+	    if (no_worse && better) {
+		dominated = true;
+		break;
+	    }
+	}
+	if (!dominated)
+	    front.push_back(&a);
+    }
+    std::sort(front.begin(), front.end(), [](const bot_res *a, const bot_res *b) { return a->rays_per_sec > b->rays_per_sec; });
+
+    /* Report */
+    auto val = [](int v) { return (v < 0) ? std::string("default") : std::to_string(v); };
+    std::cout << "BoT piece tuning (" << prefix << "), " << search << " search, " << results.size() << " trials of " << num_rays << " rays\n";
+    std::cout << "  Pareto-best settings:\n";
+    std::cout << "   minpieces tri_per_piece    prep [s]    mem [MB]       rays/sec\n";
+    for (const bot_res *r : front) {
+	std::cout << std::fixed << std::setprecision(2)
+		  << "  " << std::setw(10) << val(r->minpieces)
+		  << std::setw(14) << val(r->tri_per_piece)
+		  << std::setw(12) << r->prep_sec
+		  << std::setw(12) << r->mem_mb
+		  << std::setw(15) << r->rays_per_sec << "\n";
+    }
+    auto def = results.find(std::make_pair(-1, -1));
+    if (def != results.end())
+	std::cout << std::fixed << std::setprecision(2) << "Rays/sec [default] (" << prefix << "): " << def->second.rays_per_sec << "\n";
+    std::cout << std::fixed << std::setprecision(2) << "Rays/sec [best]    (" << prefix << "): " << front.front()->rays_per_sec << "\n";
+    std::cout << "Suggested rt_bot_minpieces    (" << prefix << "): " << val(front.front()->minpieces) << "\n";
+    std::cout << "Suggested rt_bot_tri_per_piece (" << prefix << "): " << val(front.front()->tri_per_piece) << "\n";
+}
 
 // Local Variables:
 // tab-width: 8
@@ -47,15 +47,22 @@ static int
 hit(struct application * a, struct partition *PartHeadp, struct seg * s)
 {
     auto &writer = tsj::Writer::instance();
+    int written = 0;
 
     /* walk the partition list */
     for (struct partition *pp = PartHeadp->pt_forw; pp != PartHeadp; pp = pp->pt_forw) {
 
+	/* first-hit queries only record the partitions they asked for -
+	 * librt may hand back more than a_onehit once it stops early */
+	if (a->a_onehit > 0 && written >= a->a_onehit)
+	    break;
+
 	/* generate the in/out normals */
 	RT_HIT_NORMAL(pp->pt_inhit->hit_normal, pp->pt_inhit, pp->pt_inseg->seg_stp, a->a_ray, 0);
 	RT_HIT_NORMAL(pp->pt_inhit->hit_normal, pp->pt_outhit, pp->pt_outseg->seg_stp, a->a_ray, 0);
 
 	writer.addPartition(pp);
+	written++;
     }
     return 0;
 }
@@ -98,7 +105,7 @@ rt_diff_getbox(void *g, point_t * min, point_t * max)
 }
 
 extern "C" void           *
-rt_diff_constructor(const char *file, int numreg, const char **regs, std::string outFileName)
+rt_diff_constructor(const char *file, int numreg, const char **regs, std::string outFileName, const AppConfig &acfg)
 {
     struct application *a;
     char            descr[BUFSIZ];
@@ -116,6 +123,10 @@ rt_diff_constructor(const char *file, int numreg, const char **regs, std::string
     a->a_hit = hit;
     a->a_miss = miss;
 
+    /* first-hit (visibility) queries */
+    a->a_onehit = acfg.onehit;
+    a->a_ray_length = acfg.max_dist;
+
     a->a_rt_i = rt_dirbuild(file, descr, 0);	/* attach the db file */
     if (a->a_rt_i == NULL) {
 	fprintf(stderr, "RT: Failed to load database: %s\n", file);
@@ -123,14 +134,36 @@ rt_diff_constructor(const char *file, int numreg, const char **regs, std::string
 	return NULL;
     }
 
+    /* BoTs are split into pieces (each its own leaf candidate in the space
+     * partition) by rt_bot_prep, which reads these process wide limits -
+     * override them just for this prep */
+    size_t minpieces = rt_bot_minpieces;
+    size_t tri_per_piece = rt_bot_tri_per_piece;
+    if (acfg.bot_minpieces >= 0)
+	rt_bot_minpieces = (size_t)acfg.bot_minpieces;
+    if (acfg.bot_tri_per_piece > 0)
+	rt_bot_tri_per_piece = (size_t)acfg.bot_tri_per_piece;
+
     a->a_resource = (struct resource *)bu_calloc(1, sizeof(struct resource), "resource");
     rt_init_resource(a->a_resource, 0, a->a_rt_i);
 
+    /* LIBRT_BOT_MINTIE decides which BoTs get TIE acceleration when
+     * rt_bot_prep is called.  If the caller asked for a specific threshold
+     * (e.g. --diff-against rt:bot_mintie=0), override it just for this prep */
+    ScopedBotMintie mintie(acfg.bot_mintie);
+
     while (numreg--)
 	rt_gettree(a->a_rt_i, *regs++);	/* load up the named regions */
     rt_prep_parallel(a->a_rt_i, bu_avail_cpus());	/* and compile to in-mem
 							 * versions */
 
+    /* put the caller's BoT piece limits back */
+    rt_bot_minpieces = minpieces;
+    rt_bot_tri_per_piece = tri_per_piece;
+
+    /* Prep is complete, restore the env LIBRT_BOT_MINTIE value */
+    mintie.restore();
+
     return (void *) a;
 }
 
@@ -140,6 +173,8 @@ rt_diff_destructor(void *g)
     struct application *a = (struct application *)g;
 
     // cleanup
+    rt_clean_resource(a->a_rt_i, a->a_resource);
+    bu_free(a->a_resource, "resource");
     rt_free_rti(a->a_rt_i);
     bu_free(a, "free RT application");
     return 0;
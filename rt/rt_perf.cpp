@@ -43,13 +43,30 @@ hit(struct application * a, struct partition *PartHeadp, struct seg * s)
 {
     /* (set! a->a_uptr (map translate p)) */
     struct partition *pp;
+    struct curvature cv;
+    struct uvcoord uv;
+    int level = a->a_user;	/* HitLevel, set by configure */
+
+    /* traversal only - librt has already built the partition list */
+    if (level < HIT_NORMALS)
+	return 0;
 
     /* walk the partition list */
     for (pp = PartHeadp->pt_forw; pp != PartHeadp; pp = pp->pt_forw) {
 
 	/* generate the in/out normals */
-	RT_HIT_NORMAL(pp->pt_inhit->hit_normal, pp->pt_inhit, pp->pt_inseg->seg_stp, a->a_ray, 0);
-	RT_HIT_NORMAL(pp->pt_inhit->hit_normal, pp->pt_outhit, pp->pt_outseg->seg_stp, a->a_ray, 0);
+	RT_HIT_NORMAL(pp->pt_inhit->hit_normal, pp->pt_inhit, pp->pt_inseg->seg_stp, a->a_ray, pp->pt_inflip);
+	RT_HIT_NORMAL(pp->pt_outhit->hit_normal, pp->pt_outhit, pp->pt_outseg->seg_stp, a->a_ray, pp->pt_outflip);
+
+	if (level >= HIT_CURVATURE) {
+	    RT_CURVATURE(&cv, pp->pt_inhit, pp->pt_inflip, pp->pt_inseg->seg_stp);
+	    RT_CURVATURE(&cv, pp->pt_outhit, pp->pt_outflip, pp->pt_outseg->seg_stp);
+	}
+
+	if (level >= HIT_UV) {
+	    RT_HIT_UVCOORD(a, pp->pt_inseg->seg_stp, pp->pt_inhit, &uv);
+	    RT_HIT_UVCOORD(a, pp->pt_outseg->seg_stp, pp->pt_outhit, &uv);
+	}
     }
     return 0;
 }
@@ -86,8 +103,25 @@ rt_perf_getbox(void *g, point_t * min, point_t * max)
     return 0;
 }
 
+/* (re)apply the per-shot application settings - these don't require a re-prep */
+void
+rt_perf_configure(void *g, const AppConfig &acfg)
+{
+    struct application *a = (struct application *)g;
+
+    /* first-hit (visibility) queries */
+    a->a_onehit = acfg.onehit;
+    a->a_ray_length = acfg.max_dist;
+
+    /* raw segments only - skips boolean weaving */
+    a->a_no_booleans = acfg.no_booleans;
+
+    /* per-partition work done in hit() */
+    a->a_user = acfg.hit_level;
+}
+
 void           *
-rt_perf_constructor(const char *file, int numreg, const char **regs)
+rt_perf_constructor(const char *file, int numreg, const char **regs, const AppConfig &acfg)
 {
     struct application *a;
     char            descr[BUFSIZ];
@@ -105,6 +139,8 @@ rt_perf_constructor(const char *file, int numreg, const char **regs)
     a->a_hit = hit;
     a->a_miss = miss;
 
+    rt_perf_configure((void *)a, acfg);
+
     a->a_rt_i = rt_dirbuild(file, descr, 0);	/* attach the db file */
     if (a->a_rt_i == NULL) {
 	fprintf(stderr, "RT: Failed to load database: %s\n", file);
@@ -112,10 +148,33 @@ rt_perf_constructor(const char *file, int numreg, const char **regs)
 	return NULL;
     }
 
+    /* BoTs are split into pieces (each its own leaf candidate in the space
+     * partition) by rt_bot_prep, which reads these process wide limits -
+     * override them just for this prep */
+    size_t minpieces = rt_bot_minpieces;
+    size_t tri_per_piece = rt_bot_tri_per_piece;
+    if (acfg.bot_minpieces >= 0)
+	rt_bot_minpieces = (size_t)acfg.bot_minpieces;
+    if (acfg.bot_tri_per_piece > 0)
+	rt_bot_tri_per_piece = (size_t)acfg.bot_tri_per_piece;
+
+    /* LIBRT_BOT_MINTIE decides which BoTs get TIE acceleration when
+     * rt_bot_prep is called.  If the caller asked for a specific threshold,
+     * override it just for this prep (see tie_perf.cpp) */
+    ScopedBotMintie mintie(acfg.bot_mintie);
+
     while (numreg--)
 	rt_gettree(a->a_rt_i, *regs++);	/* load up the named regions */
     rt_prep_parallel(a->a_rt_i, bu_avail_cpus());	/* and compile to in-mem
 							 * versions */
+
+    /* put the caller's BoT piece limits back */
+    rt_bot_minpieces = minpieces;
+    rt_bot_tri_per_piece = tri_per_piece;
+
+    /* Prep is complete, restore the env LIBRT_BOT_MINTIE value */
+    mintie.restore();
+
     return (void *) a;
 }
 
@@ -33,6 +33,9 @@
 #include "tie/tie_diff.h"
 #include "tie/tie_perf.h"
 #include "comp/compare_config.h"
+#include "comp/shotbin.h"
+#include "comp/shot_comp.h"
+#include "app_config.h"
 
 #include "rtcmp.h"
 
@@ -40,7 +43,7 @@
 struct ProgramOptions {
     /*** Global Options ***/
     int ncpus = 0;						    // >1: parallel | 1: serial | 0: maximize CPU
-    int rays_per_view = 1e5;					    // rays fired per view	((TODO: is this only used for comp runs now?))
+    int64_t rays_per_view = 1e5;				    // rays fired per view	((TODO: is this only used for comp runs now?))
     std::vector<std::string> non_opts;				    // unmatched options
 
     /*** Which run are we doing ***/
@@ -49,15 +52,69 @@ struct ProgramOptions {
     bool performance_run = false;				    // run tests, track performance - don't write results
     bool diff_run = false;					    // generate input file for difference tests
     bool compare_run = false;					    // compare JSON results files
+    bool convert_run = false;					    // convert a results file between NDJSON and binary
 
     /*** Options needed for diff / comparison ***/
     CompareConfig compare_opts;
+    std::string shard;						    // "k/N": shoot slice k of N of the rays (sets compare_opts.shard/nshards)
+    std::string diff_against;					    // "engine[:key=value,...]": second engine of an in-process diff run
+
+    /*** Options applied to the raytrace application (perf and diff) ***/
+    AppConfig app_opts;
 
     /*** Options needed for perf ***/
     double perf_seconds = 20;					    // number of seconds to run perf
     size_t perf_max_memory = 0;					    // limit memory usage for long perf runs
+    bool perf_hit_levels = false;				    // report throughput at every hit processing level
+    bool perf_booleans = false;					    // split cost into intersection and boolean weaving
+    std::vector<int> perf_mintie_sweep;				    // LIBRT_BOT_MINTIE values to re-prep and measure at
+    std::string perf_tune_bot;					    // BoT piece tuning search: grid | descent
 };
 
+/* Parse "engine[:key=value,...]" - the second engine of an in-process
+ * diff run and the settings it overrides in base */
+static bool
+parse_diff_against(const std::string& spec, const AppConfig& base, bool *use_tie, AppConfig *cfg)
+{
+    *cfg = base;
+    std::string engine = spec.substr(0, spec.find(':'));
+    if (engine != "rt" && engine != "tie") {
+	std::cerr << "unknown engine '" << engine << "' (expected rt or tie)\n";
+	return false;
+    }
+    *use_tie = (engine == "tie");
+
+    std::string settings = (spec.find(':') == std::string::npos) ? std::string() : spec.substr(spec.find(':') + 1);
+    std::istringstream in(settings);
+    std::string kv;
+    while (std::getline(in, kv, ',')) {
+	size_t eq = kv.find('=');
+	std::string key = kv.substr(0, eq);
+	const char *val = (eq == std::string::npos) ? "" : kv.c_str() + eq + 1;
+	char *end = NULL;
+	double v = strtod(val, &end);
+	if (eq == std::string::npos || end == val || *end) {
+	    std::cerr << "expected key=value, got '" << kv << "'\n";
+	    return false;
+	}
+	if (key == "onehit")
+	    cfg->onehit = (int)v;
+	else if (key == "bot_mintie")
+	    cfg->bot_mintie = (int)v;
+	else if (key == "bot_minpieces")
+	    cfg->bot_minpieces = (int)v;
+	else if (key == "bot_tri_per_piece")
+	    cfg->bot_tri_per_piece = (int)v;
+	else if (key == "max_dist")
+	    cfg->max_dist = v;
+	else {
+	    std::cerr << "unknown setting '" << key << "' (expected onehit, bot_mintie, bot_minpieces, bot_tri_per_piece or max_dist)\n";
+	    return false;
+	}
+    }
+    return true;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -76,13 +133,42 @@ main(int argc, char **argv)
 	    ("p,performance-test", "Run tests for raytracing speed (doesn't store and write results)", cxxopts::value<bool>(opts.performance_run))
 	    ("d,difference-test",  "Run tests to generate input files for difference comparisons", cxxopts::value<bool>(opts.diff_run))
 	    ("t,tolerance",        "Numerical tolerance to use when comparing numbers", cxxopts::value<double>(opts.compare_opts.tol))
-	    ("c,compare",          "Compare two JSON results files", cxxopts::value<bool>(opts.compare_run))
-	    ("rays-per-view",      "Number of rays to fire per view (default is 1e5)", cxxopts::value<int>(opts.rays_per_view))
+	    ("c,compare",          "Compare two JSON results files; either may be '-' (stdin) or a named pipe, read while its diff run writes it", cxxopts::value<bool>(opts.compare_run))
+	    ("convert",            "Convert a results file between NDJSON and binary (in.json out.bin or in.bin out.json)", cxxopts::value<bool>(opts.convert_run))
+	    ("rays-per-view",      "Number of rays to fire per view (default is 1e5)", cxxopts::value<int64_t>(opts.rays_per_view))
 	    ("perf-seconds",       "(perf run)Number of seconds to run (default is 20s)", cxxopts::value<double>(opts.perf_seconds))
 	    ("perf-max_memory",    "(perf run)Limit memory in a perf run (default '0' does not limit memory)", cxxopts::value<size_t>(opts.perf_max_memory))
+	    ("perf-hit-levels",    "(perf run)Report throughput at every hit processing level (traversal, normals, curvature, uv)", cxxopts::value<bool>(opts.perf_hit_levels))
+	    ("hit-level",          "(perf run)Work done per partition: 0 traversal only, 1 normals (default), 2 normals+curvature, 3 normals+curvature+uv", cxxopts::value<int>(opts.app_opts.hit_level))
+	    ("perf-booleans",      "(perf run)Shoot each view with and without boolean weaving (a_no_booleans) and report the weaving share of the cost", cxxopts::value<bool>(opts.perf_booleans))
+	    ("perf-mintie-sweep",  "(perf run)Comma separated LIBRT_BOT_MINTIE values; re-preps at each and suggests the best threshold", cxxopts::value<std::vector<int>>(opts.perf_mintie_sweep))
+	    ("bot-mintie",         "(perf/difference run)LIBRT_BOT_MINTIE to prep with (default '-1' keeps the engine default)", cxxopts::value<int>(opts.app_opts.bot_mintie))
+	    ("perf-tune-bot",      "(perf run)Tune how BoTs are split into space partitioning pieces (rt_bot_minpieces/rt_bot_tri_per_piece) with a 'grid' or 'descent' search", cxxopts::value<std::string>(opts.perf_tune_bot))
+	    ("bot-minpieces",      "(perf/difference run)rt_bot_minpieces to prep with, '0' keeps BoTs whole (default '-1' keeps the librt default)", cxxopts::value<int>(opts.app_opts.bot_minpieces))
+	    ("bot-tri-per-piece",  "(perf/difference run)rt_bot_tri_per_piece to prep with (default '-1' keeps the librt default)", cxxopts::value<int>(opts.app_opts.bot_tri_per_piece))
+	    ("onehit",             "(perf/difference run)Stop after the first N partitions per ray, e.g. 1 for line-of-sight queries (default '0' returns all)", cxxopts::value<int>(opts.app_opts.onehit))
+	    ("max-dist",           "(perf/difference run)Ignore hits farther than this distance along the ray (default '0' does not limit)", cxxopts::value<double>(opts.app_opts.max_dist))
+	    ("diff-ordered",       "(difference/compare run)Write shots in ray order independent of thread count, and compare such files in one linear pass", cxxopts::value<bool>(opts.compare_opts.ordered))
+	    ("diff-binary",        "(difference run)Write results in the binary columnar format (default file is shots.bin)", cxxopts::value<bool>(opts.compare_opts.binary))
+	    ("diff-compact",       "(difference run)Leave hit points out of the results; readers rebuild them from the ray and hit distance", cxxopts::value<bool>(opts.compare_opts.compact))
+	    ("diff-compress",      "(difference run)Losslessly compress binary results; also applies to NDJSON -> binary --convert (implies --diff-binary)", cxxopts::value<bool>(opts.compare_opts.compress))
+	    ("compare-derived",    "(compare run)Also compare hit points rebuilt from compact results (default compares their distances only)", cxxopts::value<bool>(opts.compare_opts.compare_derived))
+	    ("diff-region-ids",    "(difference run)Write a region id per partition and one region name table at the end of the results, rather than repeating full region paths", cxxopts::value<bool>(opts.compare_opts.region_ids))
+	    ("diff-digest",        "(difference run)Write only a 64 bit digest per ray, quantized to the tolerance (default file is shots.dgst); compares check digests first", cxxopts::value<bool>(opts.compare_opts.digest))
+	    ("diff-digest-detail", "(difference run)With --diff-digest, also write the full shots to this file so mismatching digests can be checked in detail", cxxopts::value<std::string>(opts.compare_opts.digest_detail_file))
+	    ("diff-max-memory",    "(difference run)Limit memory used to buffer shot output (default '0' uses two 4MB blocks per thread)", cxxopts::value<size_t>(opts.compare_opts.max_memory))
+	    ("diff-against",       "(difference run)Shoot every ray through a second engine in the same process and write only the shots that differ, e.g. 'tie' or 'rt:bot_minpieces=0,bot_mintie=0'", cxxopts::value<std::string>(opts.diff_against))
+	    ("diff-refine",        "(difference run)With --diff-against, shoot N levels of ever denser grids around each area of differing rays through both engines and report how far it extends", cxxopts::value<int>(opts.compare_opts.refine_levels))
+	    ("diff-budget",        "(difference run)Stop after this many seconds, shooting rays in a progressive order that covers every view evenly at any point; the ray file records how far the run got, so a second build given it with --input-rays replays exactly those rays (implies --diff-ordered)", cxxopts::value<double>(opts.compare_opts.budget_seconds))
+	    ("diff-update",        "(difference run)Update this earlier results file for changed geometry, re-shooting only the rays whose partitions touch a changed region or whose line crosses its bounding box, into the output file", cxxopts::value<std::string>(opts.compare_opts.update_file))
+	    ("changed-regions",    "(difference run)With --diff-update, comma separated regions (names, or leading paths such as /all/engine) that changed", cxxopts::value<std::vector<std::string>>(opts.compare_opts.changed_regions))
+	    ("changed-since",      "(difference run)With --diff-update, the older .g file the earlier results were shot from; regions whose object trees differ from it are the changed ones", cxxopts::value<std::string>(opts.compare_opts.changed_since))
+	    ("resume",             "(difference run)Continue an interrupted --diff-ordered run from its last checkpoint, shooting only the rays it had not written (implies --diff-ordered)", cxxopts::value<bool>(opts.compare_opts.resume))
+	    ("diff-checkpoint",    "(difference run)Seconds between checkpoints of --diff-ordered runs, which --resume restarts from (default 60, '0' disables)", cxxopts::value<double>(opts.compare_opts.checkpoint_seconds))
+	    ("shard",              "(difference run)Shoot only slice k (0 based) of N of the rays, given as k/N; writes a shard file and a manifest naming all N shards", cxxopts::value<std::string>(opts.shard))
 	    ("input-rays",         "(difference run)Provide a name for the input ray file to generate shot data from", cxxopts::value<std::string>(opts.compare_opts.in_ray_file))
 	    ("output-rays",        "(compare run)Provide a name for the output file (default is shots.rays)", cxxopts::value<std::string>(opts.compare_opts.ray_file))
-	    ("output-json",        "(compare run)Provide a name for the JSON output file (default is shots.json)", cxxopts::value<std::string>(opts.compare_opts.json_ofile))
+	    ("output-json",        "(compare run)Provide a name for the JSON output file (default is shots.json); '-' (stdout) or a named pipe streams the shots in ray order to a concurrent -c", cxxopts::value<std::string>(opts.compare_opts.json_ofile))
 	    ("output-nirt",        "(compare run)Provide a name for the NIRT output file (default is diff.nrt)", cxxopts::value<std::string>(opts.compare_opts.nirt_file))
 	    ("output-plot3",       "(compare run)Provide a name for the PLOT3 output file (default is diff.plot3)", cxxopts::value<std::string>(opts.compare_opts.plot3_file))
 	    ("h,help",             "Print help")
@@ -92,6 +178,83 @@ main(int argc, char **argv)
 	// unmatched supplied options
 	opts.non_opts = result.unmatched();
 
+	// only ordered runs are checkpointed
+	if (opts.compare_opts.resume)
+	    opts.compare_opts.ordered = true;
+
+	// budgeted runs write a prefix of their progressive order
+	if (opts.compare_opts.budget_seconds > 0) {
+	    // digest chunks assume contiguous ray ranges, which a progressive
+	    // order does not give
+	    if (opts.compare_opts.resume || !opts.shard.empty() || !opts.diff_against.empty() || opts.compare_opts.digest) {
+		std::cerr << "error parsing options: --diff-budget cannot be combined with --resume, --shard, --diff-against or --diff-digest\n";
+		return -1;
+	    }
+	    opts.compare_opts.ordered = true;
+	}
+
+	// binary results get their own default name
+	if (opts.compare_opts.compress)
+	    opts.compare_opts.binary = true;
+	if (opts.compare_opts.binary && !result.count("output-json"))
+	    opts.compare_opts.json_ofile = "shots.bin";
+	if (opts.compare_opts.digest && !result.count("output-json"))
+	    opts.compare_opts.json_ofile = "shots.dgst";
+
+	// sharded runs shoot one of N disjoint slices of the ray indices
+	if (!opts.shard.empty()) {
+	    int k = -1, n = 0;
+	    if (sscanf(opts.shard.c_str(), "%d/%d", &k, &n) != 2 || n < 1 || k < 0 || k >= n) {
+		std::cerr << "error parsing options: --shard expects k/N with 0 <= k < N, got " << opts.shard << "\n";
+		return -1;
+	    }
+	    opts.compare_opts.shard = k;
+	    opts.compare_opts.nshards = n;
+	}
+
+	// refinement re-shoots through both engines of an in-process run
+	if (opts.compare_opts.refine_levels > 0 && opts.diff_against.empty()) {
+	    std::cerr << "error parsing options: --diff-refine needs --diff-against\n";
+	    return -1;
+	}
+
+	// in-process runs keep only the differing shots, written whole at the end
+	if (!opts.diff_against.empty()) {
+	    const CompareConfig& c = opts.compare_opts;
+	    if (c.digest || c.region_ids || c.resume || c.ordered || !opts.shard.empty()) {
+		std::cerr << "error parsing options: --diff-against cannot be combined with --diff-digest, --diff-region-ids, --resume, --diff-ordered or --shard\n";
+		return -1;
+	    }
+	}
+
+	// update runs splice re-shot rays into an earlier run's shots
+	if (!opts.compare_opts.update_file.empty()) {
+	    const CompareConfig& c = opts.compare_opts;
+	    if (c.changed_regions.empty() && c.changed_since.empty()) {
+		std::cerr << "error parsing options: --diff-update needs --changed-regions or --changed-since\n";
+		return -1;
+	    }
+	    if (c.digest || c.region_ids || c.resume || c.nshards > 1 || !opts.diff_against.empty() || c.budget_seconds > 0 || !c.in_ray_file.empty()) {
+		std::cerr << "error parsing options: --diff-update cannot be combined with --diff-digest, --diff-region-ids, --resume, --shard, --diff-against, --diff-budget or --input-rays\n";
+		return -1;
+	    }
+	} else if (!opts.compare_opts.changed_regions.empty() || !opts.compare_opts.changed_since.empty()) {
+	    std::cerr << "error parsing options: --changed-regions and --changed-since need --diff-update\n";
+	    return -1;
+	}
+
+	// "-" or a named pipe: stream ray ordered shots to a concurrent compare
+	if (opts.diff_run && shot_utils::is_pipe(opts.compare_opts.json_ofile)) {
+	    const CompareConfig& c = opts.compare_opts;
+	    if (c.digest || c.region_ids || c.resume || c.nshards > 1 || !opts.diff_against.empty() || c.budget_seconds > 0 || !c.update_file.empty()) {
+		std::cerr << "error parsing options: streamed output (" << c.json_ofile << ") cannot be combined with --diff-digest, --diff-region-ids, --resume, --shard, --diff-against, --diff-budget or --diff-update\n";
+		return -1;
+	    }
+	    opts.compare_opts.stream = true;
+	    opts.compare_opts.ordered = true;
+	    opts.compare_opts.checkpoint_seconds = 0;	// a pipe cannot be rewound
+	}
+
 	// looking for help?
 	if (result.count("help")) {
 	    std::cout << options.help({""}) << "\n";
@@ -107,8 +270,8 @@ main(int argc, char **argv)
     // either 'file.g component_name' for regular runs
     // or 'file1.json file2.json' for comparison runs
     if (opts.non_opts.size() != 2) {
-	if (opts.compare_run) {
-	    std::cerr << "Error:  need to specify two JSON results files\n\n";
+	if (opts.compare_run || opts.convert_run) {
+	    std::cerr << "Error:  need to specify two results files\n\n";
 	    std::cout << options.help({""}) << "\n";
 	} else {
 	    std::cerr << "Error:  need to specify a geometry file and object\n\n";
@@ -120,6 +283,10 @@ main(int argc, char **argv)
     av[0] = opts.non_opts[0].c_str();
     av[1] = opts.non_opts[1].c_str();
 
+    // shots streamed to stdout own it; reports go to stderr instead
+    if (opts.compare_opts.stream && opts.compare_opts.json_ofile == "-")
+	std::cout.rdbuf(std::cerr.rdbuf());
+
     /* Compare run (compare supplied result files) */
     if (opts.compare_run) {
 	do_comp(opts.non_opts[0].c_str(), opts.non_opts[1].c_str(), opts.compare_opts);
@@ -128,6 +295,10 @@ main(int argc, char **argv)
 	return 0;
     }
 
+    /* Convert run (rewrite a results file in the other format) */
+    if (opts.convert_run)
+	return (shotbin::convert(opts.non_opts[0], opts.non_opts[1], opts.compare_opts.compress)) ? 0 : -1;
+
     /* Dry run (no shotlining, establishes overhead costs - diff run is a no-op) */
     if (opts.dry_run) {
 	if (opts.diff_run) {
@@ -136,26 +307,64 @@ main(int argc, char **argv)
 	    return -1;
 	}
 	// FIXME: dry still fires all rays for perf run
-	do_perf_run("dry", 2, (const char **)av, opts.ncpus, opts.perf_seconds, opts.perf_max_memory, dry_constructor, dry_getbox, dry_getsize, dry_shoot, dry_destructor);
+	do_perf_run("dry", 2, (const char **)av, opts.ncpus, opts.perf_seconds, opts.perf_max_memory, dry_constructor, dry_getbox, dry_getsize, dry_shoot, dry_destructor, opts.app_opts);
+    }
+
+    static const DiffEngine rt_engine = {"rt", rt_diff_constructor, rt_diff_getbox, rt_diff_getsize, rt_diff_shoot, rt_diff_destructor};
+    static const DiffEngine tie_engine = {"tie", tie_diff_constructor, tie_diff_getbox, tie_diff_getsize, tie_diff_shoot, tie_diff_destructor};
+
+    /* Update run (re-shoot only the rays of changed regions) */
+    if (opts.diff_run && !opts.compare_opts.update_file.empty()) {
+	do_diff_update_run(2, (const char **)av, opts.ncpus, (opts.use_tie) ? tie_engine : rt_engine, opts.compare_opts, opts.app_opts);
+	opts.diff_run = false;	// done - perf runs may still follow
+    }
+
+    /* In-process differential run (two engines side by side) */
+    if (opts.diff_run && !opts.diff_against.empty()) {
+	bool against_tie = false;
+	AppConfig against_opts;
+	if (!parse_diff_against(opts.diff_against, opts.app_opts, &against_tie, &against_opts)) {
+	    std::cerr << "Error:  bad --diff-against " << opts.diff_against << "\n";
+	    return -1;
+	}
+	do_diff_pair_run(2, (const char **)av, opts.ncpus, opts.rays_per_view,
+			 (opts.use_tie) ? tie_engine : rt_engine, opts.app_opts,
+			 (against_tie) ? tie_engine : rt_engine, against_opts, opts.compare_opts);
+	opts.diff_run = false;	// done - perf runs may still follow
     }
 
     /* Diff and/or Performance run */
     if (opts.use_tie) {
 	/* TIE */
 	if (opts.diff_run) {
-	    // TODO: edited constructor signature
-	    //do_diff_run("tie", 2, (const char **)av, ncpus, rays_per_view, tie_diff_constructor, tie_diff_getbox, tie_diff_getsize, tie_diff_shoot, tie_diff_destructor, dinfo);
+	    do_diff_run("tie", 2, (const char **)av, opts.ncpus, opts.rays_per_view, tie_diff_constructor, tie_diff_getbox, tie_diff_getsize, tie_diff_shoot, tie_diff_destructor, opts.compare_opts, opts.app_opts);
 	}
-	if (opts.performance_run) {
-	    do_perf_run("tie", 2, (const char **)av, opts.ncpus, opts.perf_seconds, opts.perf_max_memory, tie_perf_constructor, tie_perf_getbox, tie_perf_getsize, tie_perf_shoot, tie_perf_destructor);
+	if (opts.performance_run && !opts.perf_tune_bot.empty()) {
+	    do_bot_tune_run("tie", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, opts.perf_tune_bot, tie_perf_constructor, tie_perf_getbox, tie_perf_getsize, tie_perf_shoot, tie_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run && !opts.perf_mintie_sweep.empty()) {
+	    do_mintie_sweep_run("tie", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, opts.perf_mintie_sweep, tie_perf_constructor, tie_perf_getbox, tie_perf_getsize, tie_perf_shoot, tie_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run && opts.perf_hit_levels) {
+	    do_hit_level_perf_run("tie", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, tie_perf_constructor, tie_perf_getbox, tie_perf_getsize, tie_perf_shoot, tie_perf_configure, tie_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run && opts.perf_booleans) {
+	    do_bool_perf_run("tie", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, tie_perf_constructor, tie_perf_getbox, tie_perf_getsize, tie_perf_shoot, tie_perf_configure, tie_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run) {
+	    do_perf_run("tie", 2, (const char **)av, opts.ncpus, opts.perf_seconds, opts.perf_max_memory, tie_perf_constructor, tie_perf_getbox, tie_perf_getsize, tie_perf_shoot, tie_perf_destructor, opts.app_opts);
 	}
     } else {
 	/* Regular rt */
 	if (opts.diff_run) {
-	    do_diff_run("rt", 2, (const char **)av, opts.ncpus, opts.rays_per_view, rt_diff_constructor, rt_diff_getbox, rt_diff_getsize, rt_diff_shoot, rt_diff_destructor, opts.compare_opts);
+	    do_diff_run("rt", 2, (const char **)av, opts.ncpus, opts.rays_per_view, rt_diff_constructor, rt_diff_getbox, rt_diff_getsize, rt_diff_shoot, rt_diff_destructor, opts.compare_opts, opts.app_opts);
 	}
-	if (opts.performance_run) {
-	    do_perf_run("rt", 2, (const char **)av, opts.ncpus, opts.perf_seconds, opts.perf_max_memory, rt_perf_constructor, rt_perf_getbox, rt_perf_getsize, rt_perf_shoot, rt_perf_destructor);
+	if (opts.performance_run && !opts.perf_tune_bot.empty()) {
+	    do_bot_tune_run("rt", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, opts.perf_tune_bot, rt_perf_constructor, rt_perf_getbox, rt_perf_getsize, rt_perf_shoot, rt_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run && !opts.perf_mintie_sweep.empty()) {
+	    do_mintie_sweep_run("rt", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, opts.perf_mintie_sweep, rt_perf_constructor, rt_perf_getbox, rt_perf_getsize, rt_perf_shoot, rt_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run && opts.perf_hit_levels) {
+	    do_hit_level_perf_run("rt", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, rt_perf_constructor, rt_perf_getbox, rt_perf_getsize, rt_perf_shoot, rt_perf_configure, rt_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run && opts.perf_booleans) {
+	    do_bool_perf_run("rt", 2, (const char **)av, opts.perf_seconds, opts.perf_max_memory, rt_perf_constructor, rt_perf_getbox, rt_perf_getsize, rt_perf_shoot, rt_perf_configure, rt_perf_destructor, opts.app_opts);
+	} else if (opts.performance_run) {
+	    do_perf_run("rt", 2, (const char **)av, opts.ncpus, opts.perf_seconds, opts.perf_max_memory, rt_perf_constructor, rt_perf_getbox, rt_perf_getsize, rt_perf_shoot, rt_perf_destructor, opts.app_opts);
 	}
     }
 
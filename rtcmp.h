@@ -27,12 +27,14 @@
 #define RTCMP_H
 
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <brlcad/vmath.h>
 #include <brlcad/bu.h>
 #include <brlcad/bn.h>
 #include <brlcad/raytrace.h>
 #include "comp/shotset.h"
+#include "app_config.h"
 
 
 /* Defines used when setting up shotline inputs */
@@ -45,25 +47,106 @@
  * of changes to the same raytracer) so outputs are not captured -
  * instead, run time is measured by the caller */
 void do_perf_run(const char *prefix, int argc, const char **argv, int ncpus, double seconds, size_t max_memory,
-	void*(*constructor)(const char *, int, const char**),
+	void*(*constructor)(const char *, int, const char**, const AppConfig&),
 	int(*getbox)(void *, point_t *, point_t *),
 	double(*getsize)(void*),
 	void (*shoot)(void*, struct xray *),
-	int(*destructor)(void *));
+	int(*destructor)(void *),
+	const AppConfig& acfg);
+
+/* Split the perf cost into intersection and boolean weaving - each view
+ * is shot twice on the same prepped geometry, once normally and once with
+ * a_no_booleans set, and the difference is reported per view and as
+ * per-ray percentiles */
+void do_bool_perf_run(const char *prefix, int argc, const char **argv, double seconds, size_t max_memory,
+	void*(*constructor)(const char *, int, const char**, const AppConfig&),
+	int(*getbox)(void *, point_t *, point_t *),
+	double(*getsize)(void*),
+	void (*shoot)(void*, struct xray *),
+	void (*configure)(void*, const AppConfig&),
+	int(*destructor)(void *),
+	const AppConfig& acfg);
+
+/* Measure throughput at each HitLevel on the same prepped geometry so the
+ * cost of shading-side work (normals, curvature, uv) in the primitives can
+ * be told apart from the intersection cost */
+void do_hit_level_perf_run(const char *prefix, int argc, const char **argv, double seconds, size_t max_memory,
+	void*(*constructor)(const char *, int, const char**, const AppConfig&),
+	int(*getbox)(void *, point_t *, point_t *),
+	double(*getsize)(void*),
+	void (*shoot)(void*, struct xray *),
+	void (*configure)(void*, const AppConfig&),
+	int(*destructor)(void *),
+	const AppConfig& acfg);
+
+/* Re-prep the geometry once per LIBRT_BOT_MINTIE value and measure prep
+ * time, memory and throughput at each, suggesting the best threshold */
+void do_mintie_sweep_run(const char *prefix, int argc, const char **argv, double seconds, size_t max_memory,
+	const std::vector<int>& mintie_vals,
+	void*(*constructor)(const char *, int, const char**, const AppConfig&),
+	int(*getbox)(void *, point_t *, point_t *),
+	double(*getsize)(void*),
+	void (*shoot)(void*, struct xray *),
+	int(*destructor)(void *),
+	const AppConfig& acfg);
+
+/* Re-prep the geometry over a grid (or coordinate descent) of the BoT piece
+ * limits rt_bot_minpieces / rt_bot_tri_per_piece with short fixed-work
+ * trials, reporting prep time, memory and throughput and the Pareto-best
+ * settings */
+void do_bot_tune_run(const char *prefix, int argc, const char **argv, double seconds, size_t max_memory,
+	const std::string& search,
+	void*(*constructor)(const char *, int, const char**, const AppConfig&),
+	int(*getbox)(void *, point_t *, point_t *),
+	double(*getsize)(void*),
+	void (*shoot)(void*, struct xray *),
+	int(*destructor)(void *),
+	const AppConfig& acfg);
 
 /* Do a run to generate a file used to identify differences between
  * raytracing results.  This will produce a sizable output file, and
  * may run rather slowly since shotline intersection data is being captured
  * for output. */
 void
-do_diff_run(const char *prefix, int argc, const char **argv, int ncpus, int nvrays,
-	void*(*constructor)(const char *, int, const char**, std::string),
+do_diff_run(const char *prefix, int argc, const char **argv, int ncpus, int64_t nvrays,
+	void*(*constructor)(const char *, int, const char**, std::string, const AppConfig&),
 	int(*getbox)(void *, point_t *, point_t *),
 	double(*getsize)(void*),
 	void (*shoot)(void*, struct xray *),
 	int(*destructor)(void *),
+	CompareConfig& dinfo,
+	const AppConfig& acfg);
+
+/* Entry points of one diff engine (rt/rt_diff.h, tie/tie_diff.h) */
+struct DiffEngine {
+    const char *prefix;
+    void*(*constructor)(const char *, int, const char**, std::string, const AppConfig&);
+    int(*getbox)(void *, point_t *, point_t *);
+    double(*getsize)(void*);
+    void (*shoot)(void*, struct xray *);
+    int(*destructor)(void *);
+};
+
+/* In-process differential run: prep engine a and engine b (which may be
+ * the same engine with different settings) side by side, shoot every ray
+ * through both and compare the shots in memory.  Only the shots that
+ * differ are written - a's to dinfo.json_ofile and b's next to it - along
+ * with a summary of the differences */
+void
+do_diff_pair_run(int argc, const char **argv, int ncpus, int64_t nvrays,
+	const DiffEngine& a, const AppConfig& acfg_a,
+	const DiffEngine& b, const AppConfig& acfg_b,
 	CompareConfig& dinfo);
 
+/* Update run: splice a new diff run together from an earlier one
+ * (dinfo.update_file), re-shooting only the rays whose stored partitions
+ * touch a changed region or whose line crosses one's bounding box.  The
+ * changed regions are dinfo.changed_regions, plus those whose object trees
+ * differ from the ones in dinfo.changed_since */
+void
+do_diff_update_run(int argc, const char **argv, int nthreads, const DiffEngine& e,
+	CompareConfig& dinfo, const AppConfig& acfg);
+
 /* Do a comparison between two generated results files (from do_diff_run()).
  * produces output file of differing rays
  */
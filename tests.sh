@@ -31,6 +31,12 @@ CLEANUP_OUTPUT_ARTIFACTS="${CLEANUP_OUTPUT_ARTIFACTS:-1}"
 TOLS_LIST="${TOLS_LIST:-1e-15 1e-12 1e-1}"
 DO_ALL_TOLS="${DO_ALL_TOLS:-0}"     # don't stop at first failing tol
 
+# stream both builds' shots through named pipes into one compare instead of
+# writing JSON files - both builds run at once, each on half the cores.
+#   only the first tol is compared this way; on a failure the JSON files are
+#   generated as usual to step through the rest
+STREAM_COMPARE="${STREAM_COMPARE:-0}"
+
 # do performance tests?
 DO_PERF="${DO_PERF:-1}"
 PERF_SECONDS="${PERF_SECONDS:-3}"               # use 3 sec for perf runs
@@ -232,6 +238,68 @@ run_generate_jsons() {
     echo "$json1|$json2|$rays|$gen_time"
 }
 
+# Run both builds at the same time, each streaming its shots through a named
+# pipe into one compare at tol: "rtcmp -d --output-json pipe" x2 + "rtcmp -c"
+#   - CMD2 starts once CMD1 has written the rays (before it shoots)
+#   - returns PASS/FAIL; a build that fails is a FAIL
+run_stream_compare() {
+    local gfile="$1"
+    local comp="$2"
+    local tag="$3"
+    local tol="$4"
+
+    local pipe1="$OUTDIR/${tag}.pipe1"
+    local pipe2="$OUTDIR/${tag}.pipe2"
+    local rays="$OUTDIR/${tag}.rays"
+    local nirt="$OUTDIR/${tag}.t${tol}.nirt"
+    local clog="$OUTDIR/${tag}.t${tol}.compare.log"
+
+    # each build gets half the cores
+    local ncpus="$NUM_CPUS"
+    if [[ "$ncpus" == "0" ]]; then
+        ncpus="$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 2)"
+    fi
+    ncpus=$(( ncpus > 1 ? ncpus / 2 : 1 ))
+
+    rm -f "$pipe1" "$pipe2" "$rays"
+    mkfifo "$pipe1" "$pipe2" || die "cannot make named pipes in $OUTDIR"
+
+    "$CMD1" --output-nirt "$nirt" -t "$tol" -c "$pipe1" "$pipe2" >"$clog" 2>&1 &
+    local pidc=$!
+    "$CMD1" --rays-per-view "$RAYS_PER_VIEW" -n "$ncpus" --output-json "$pipe1" --output-rays "$rays" -d "$gfile" "$comp" >&2 &
+    local pid1=$!
+
+    # the ray file is renamed into place, so it is whole once it shows up
+    while [[ ! -f "$rays" ]] && kill -0 "$pid1" 2>/dev/null; do
+        sleep 0.1
+    done
+    local pid2=""
+    if [[ -f "$rays" ]]; then
+        "$CMD2" --rays-per-view "$RAYS_PER_VIEW" -n "$ncpus" --output-json "$pipe2" --input-rays "$rays" -d "$gfile" "$comp" >&2 &
+        pid2=$!
+    fi
+
+    # a build that failed may never have opened its pipe - open it in its
+    # place (read-write does not block) so the compare sees the stream end
+    local ok=1
+    wait "$pid1" || { ok=0; true 1<>"$pipe1"; }
+    if [[ -n "$pid2" ]]; then
+        wait "$pid2" || { ok=0; true 1<>"$pipe2"; }
+    else
+        ok=0
+        true 1<>"$pipe2"
+    fi
+    wait "$pidc" || ok=0
+    rm -f "$pipe1" "$pipe2"
+
+    local status
+    status="$(parse_compare_output "$clog")"
+    if [[ "$ok" != "1" ]]; then
+        status="FAIL"
+    fi
+    echo "$status"
+}
+
 # Parse rtcmp compare output: "rtcmp -c .json1 .json2"
 #   - PASS iff "No differences found" (THIS MUST MATCH rtcmp OUTPUT)
 parse_compare_output() {
@@ -434,23 +502,37 @@ main() {
 
             # do comp generation
             log VERBOSE "        running comparison tests..."
-            local gen_info json1 json2 rays gen_time
-            gen_info="$(run_generate_jsons "$gfile" "$comp" "$tag")"
-            json1="$(echo "$gen_info" | cut -d'|' -f1)"
-            json2="$(echo "$gen_info" | cut -d'|' -f2)"
-            rays="$(echo "$gen_info" | cut -d'|' -f3)"
-            gen_time="$(echo "$gen_info" | cut -d'|' -f4)"
-
-            log VERBOSE "            JSON's generated in $gen_time seconds"
-            log VERBOSE "            json1: $json1"
-            log VERBOSE "            json2: $json2"
-            log VERBOSE "            rays : $rays"
-
-            # do actual comp
-            local tol_start tol_end tol_time outcome comp_status pass_tol
+            local gen_info json1="" json2="" rays="$OUTDIR/${tag}.rays" gen_time
+            local tol_start tol_end tol_time outcome="" comp_status pass_tol
             tol_start="$(date +%s.%N)"
 
-            outcome="$(comp_at_stepping_tols "$json1" "$json2" "$tag")"
+            # streamed: no JSON files unless the first tol fails
+            if [[ "$STREAM_COMPARE" == "1" ]]; then
+                local first_tol
+                read -r first_tol _ <<<"$TOLS_LIST"
+                if [[ "$(run_stream_compare "$gfile" "$comp" "$tag" "$first_tol")" == "PASS" ]]; then
+                    outcome="PASS|$first_tol"
+                else
+                    log "              FAIL at tol=$first_tol (streamed), generating JSON's to step tolerances"
+                fi
+            fi
+
+            if [[ -z "$outcome" ]]; then
+                gen_info="$(run_generate_jsons "$gfile" "$comp" "$tag")"
+                json1="$(echo "$gen_info" | cut -d'|' -f1)"
+                json2="$(echo "$gen_info" | cut -d'|' -f2)"
+                rays="$(echo "$gen_info" | cut -d'|' -f3)"
+                gen_time="$(echo "$gen_info" | cut -d'|' -f4)"
+
+                log VERBOSE "            JSON's generated in $gen_time seconds"
+                log VERBOSE "            json1: $json1"
+                log VERBOSE "            json2: $json2"
+                log VERBOSE "            rays : $rays"
+
+                # do actual comp
+                tol_start="$(date +%s.%N)"
+                outcome="$(comp_at_stepping_tols "$json1" "$json2" "$tag")"
+            fi
             comp_status="$(echo "$outcome" | cut -d'|' -f1)"
             pass_tol="$(echo "$outcome" | cut -d'|' -f2)"
 
@@ -517,6 +599,7 @@ main() {
       fi
 
       echo "#CONFIG,TOLS_LIST,\"$TOLS_LIST\""
+      echo "#CONFIG,STREAM_COMPARE,\"$STREAM_COMPARE\""
       echo "#CONFIG,NUM_CPUS,\"$NUM_CPUS\""
       echo "#CONFIG,RAYS_PER_VIEW,\"$RAYS_PER_VIEW\""
       echo "#CONFIG,PERF_SECONDS,\"$PERF_SECONDS\""
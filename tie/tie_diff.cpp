@@ -36,58 +36,33 @@ extern "C" {
 #include <brlcad/raytrace.h>
 }
 
+#include <fstream>
 #include <sstream>
 #include <limits>
 #include <iomanip>
-#include "json.hpp"
+#include "comp/jsonwriter.hpp"
 #include "tie/tie_diff.h"
 
-struct app_json {
-    nlohmann::json *jshots;
-    nlohmann::json *shotparts;
-};
-
-static std::string
-d2s(double d)
-{
-    size_t prec = std::numeric_limits<double>::max_digits10;
-    std::ostringstream ss;
-    ss << std::fixed << std::setprecision(prec) << d;
-    std::string sd = ss.str();
-    return sd;
-}
 
 static int
 hit(struct application * a, struct partition *PartHeadp, struct seg * s)
 {
-    struct app_json *j = (struct app_json *)a->a_uptr;
-    nlohmann::json *shotparts = j->shotparts;
+    auto &writer = tsj::Writer::instance();
+    int written = 0;
 
     /* walk the partition list */
     for (struct partition *pp = PartHeadp->pt_forw; pp != PartHeadp; pp = pp->pt_forw) {
 
+	/* first-hit queries only record the partitions they asked for */
+	if (a->a_onehit > 0 && written >= a->a_onehit)
+	    break;
+
 	/* generate the in/out normals */
 	RT_HIT_NORMAL(pp->pt_inhit->hit_normal, pp->pt_inhit, pp->pt_inseg->seg_stp, a->a_ray, 0);
 	RT_HIT_NORMAL(pp->pt_inhit->hit_normal, pp->pt_outhit, pp->pt_outseg->seg_stp, a->a_ray, 0);
 
-	nlohmann::json jpart;
-	jpart["region"] = pp->pt_regionp->reg_name;
-	jpart["in_dist"] = d2s(pp->pt_inhit->hit_dist);
-	jpart["out_dist"] = d2s(pp->pt_outhit->hit_dist);
-	jpart["in_pt"]["X"] = d2s(pp->pt_inhit->hit_point[X]);
-	jpart["in_pt"]["Y"] = d2s(pp->pt_inhit->hit_point[Y]);
-	jpart["in_pt"]["Z"] = d2s(pp->pt_inhit->hit_point[Z]);
-	jpart["out_pt"]["X"] = d2s(pp->pt_outhit->hit_point[X]);
-	jpart["out_pt"]["Y"] = d2s(pp->pt_outhit->hit_point[Y]);
-	jpart["out_pt"]["Z"] = d2s(pp->pt_outhit->hit_point[Z]);
-	jpart["in_norm"]["X"] = d2s(pp->pt_inhit->hit_normal[X]);
-	jpart["in_norm"]["Y"] = d2s(pp->pt_inhit->hit_normal[Y]);
-	jpart["in_norm"]["Z"] = d2s(pp->pt_inhit->hit_normal[Z]);
-	jpart["out_norm"]["X"] = d2s(pp->pt_outhit->hit_normal[X]);
-	jpart["out_norm"]["Y"] = d2s(pp->pt_outhit->hit_normal[Y]);
-	jpart["out_norm"]["Z"] = d2s(pp->pt_outhit->hit_normal[Z]);
-
-	(*shotparts)["partitions"].push_back(jpart);
+	writer.addPartition(pp);
+	written++;
     }
     return 0;
 }
@@ -103,27 +78,14 @@ void
 tie_diff_shoot(void *g, struct xray * ray)
 {
     struct application *a = (struct application *)g;
-    struct app_json *j = (struct app_json *)a->a_uptr;
-
-    // Make a container for this particular shot
-
-    nlohmann::json rayparts;
-    rayparts["ray_pt"]["X"] = d2s(ray->r_pt[X]);
-    rayparts["ray_pt"]["Y"] = d2s(ray->r_pt[Y]);
-    rayparts["ray_pt"]["Z"] = d2s(ray->r_pt[Z]);
-    rayparts["ray_dir"]["X"] = d2s(ray->r_dir[X]);
-    rayparts["ray_dir"]["Y"] = d2s(ray->r_dir[Y]);
-    rayparts["ray_dir"]["Z"] = d2s(ray->r_dir[Z]);
-
-    // TODO - need parallel awareness in shotparts container?
-    j->shotparts = &rayparts;
+    auto &writer = tsj::Writer::instance();
 
     VMOVE(a->a_ray.r_pt, (*ray).r_pt);
     VMOVE(a->a_ray.r_dir, (*ray).r_dir);
-    rt_shootray(a);		/* call into librt */
 
-    // TODO - lock?
-    (*j->jshots)["shots"].push_back(rayparts);
+    writer.beginShot(*ray);
+        rt_shootray(a);		/* call into librt */
+    writer.endShot();
 }
 
 double
@@ -143,7 +105,7 @@ tie_diff_getbox(void *g, point_t * min, point_t * max)
 }
 
 extern "C" void           *
-tie_diff_constructor(const char *file, int numreg, const char **regs, nlohmann::json *j)
+tie_diff_constructor(const char *file, int numreg, const char **regs, std::string outFileName, const AppConfig &acfg)
 {
     struct application *a;
     char            descr[BUFSIZ];
@@ -161,6 +123,10 @@ tie_diff_constructor(const char *file, int numreg, const char **regs, nlohmann::
     a->a_hit = hit;
     a->a_miss = miss;
 
+    /* first-hit (visibility) queries */
+    a->a_onehit = acfg.onehit;
+    a->a_ray_length = acfg.max_dist;
+
     a->a_rt_i = rt_dirbuild(file, descr, 0);	/* attach the db file */
     if (a->a_rt_i == NULL) {
 	fprintf(stderr, "RT: Failed to load database: %s\n", file);
@@ -168,27 +134,37 @@ tie_diff_constructor(const char *file, int numreg, const char **regs, nlohmann::
 	return NULL;
     }
 
+    /* BoTs are split into pieces (each its own leaf candidate in the space
+     * partition) by rt_bot_prep, which reads these process wide limits -
+     * override them just for this prep */
+    size_t minpieces = rt_bot_minpieces;
+    size_t tri_per_piece = rt_bot_tri_per_piece;
+    if (acfg.bot_minpieces >= 0)
+	rt_bot_minpieces = (size_t)acfg.bot_minpieces;
+    if (acfg.bot_tri_per_piece > 0)
+	rt_bot_tri_per_piece = (size_t)acfg.bot_tri_per_piece;
+
+    a->a_resource = (struct resource *)bu_calloc(1, sizeof(struct resource), "resource");
+    rt_init_resource(a->a_resource, 0, a->a_rt_i);
+
     /* LIBRT_BOT_MINTIE is used only when rt_bot_prep is called, so if we
      * override the setting here to always enable, we turn the "standard" librt
      * shotline logic into a TIE enabled test. We just restore the prior
      * setting once we're done in order to localize the impact to just this
-     * test. */
-    char *tval = bu_strdup(getenv("LIBRT_BOT_MINTIE"));
-    bu_setenv("LIBRT_BOT_MINTIE", "1", 1);
+     * test.  A caller supplied threshold takes precedence over "always". */
+    ScopedBotMintie mintie((acfg.bot_mintie >= 0) ? acfg.bot_mintie : 1);
 
     while (numreg--)
 	rt_gettree(a->a_rt_i, *regs++);	/* load up the named regions */
     rt_prep_parallel(a->a_rt_i, bu_avail_cpus());	/* and compile to in-mem
 							 * versions */
-    /* Prep is complete, restore the env LIBRT_BOT_MINTIE value */
-    bu_setenv("LIBRT_BOT_MINTIE", tval, 1);
-    bu_free((char *)tval, "tval");
 
-    /* Connect the json output container to the application structure */
-    struct app_json *jc;
-    BU_GET(jc, struct app_json);
-    jc->jshots = j;
-    a->a_uptr = (void *)jc;
+    /* put the caller's BoT piece limits back */
+    rt_bot_minpieces = minpieces;
+    rt_bot_tri_per_piece = tri_per_piece;
+
+    /* Prep is complete, restore the env LIBRT_BOT_MINTIE value */
+    mintie.restore();
 
     return (void *) a;
 }
@@ -197,10 +173,10 @@ int
 tie_diff_destructor(void *g)
 {
     struct application *a = (struct application *)g;
-    struct app_json *jc = (struct app_json *)a->a_uptr;
-    BU_PUT(jc, struct app_json);
+    rt_clean_resource(a->a_rt_i, a->a_resource);
+    bu_free(a->a_resource, "resource");
     rt_free_rti(a->a_rt_i);
-    free(a);
+    bu_free(a, "free RT application");
     return 0;
 }
 
@@ -32,7 +32,7 @@
 extern "C" void    tie_diff_shoot(void *geom, struct xray * ray);
 extern "C" double  tie_diff_getsize(void *g);
 extern "C" int     tie_diff_getbox(void *g, point_t * min, point_t * max);
-extern "C" void   *tie_diff_constructor(const char *, int, const char **, nlohmann::json *);
+extern "C" void   *tie_diff_constructor(const char *, int, const char **, std::string, const AppConfig&);
 extern "C" int     tie_diff_destructor(void *);
 
 #endif
@@ -32,7 +32,8 @@
 void            tie_perf_shoot(void *geom, struct xray * ray);
 double          tie_perf_getsize(void *g);
 int             tie_perf_getbox(void *g, point_t * min, point_t * max);
-void           *tie_perf_constructor(const char*, int, const char**);
+void           *tie_perf_constructor(const char*, int, const char**, const AppConfig&);
+void            tie_perf_configure(void *, const AppConfig&);
 int             tie_perf_destructor(void *);
 
 #endif